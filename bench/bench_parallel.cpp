@@ -0,0 +1,79 @@
+/*
+        Scaling of the intra-file parallelism on a synthetic object with
+        one large .symtab
+
+                bench_parallel [symbols] [max threads]
+ */
+#include "celf/elf_file.h"
+#include "celf/symbol_index.h"
+#include "celf/json.h"
+#include "celf/thread_pool.h"
+#include "bench/synthetic_elf.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace{
+
+using namespace celf;
+
+template<class F>
+double Seconds(F const& f){
+        auto start = std::chrono::steady_clock::now();
+        f();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // end namespace
+
+int main(int argc, char** argv){
+        size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 2000000;
+        size_t max_threads = argc > 2 ? std::strtoull(argv[2], nullptr, 10)
+                                      : std::max(1u, std::thread::hardware_concurrency());
+
+        bench::SyntheticElfOptions opts;
+        opts.sections = 0;
+        opts.segments = 0;
+        opts.symbols = count;
+        auto image = std::make_shared<std::vector<char> >(bench::MakeSyntheticElf(opts));
+        MemoryView memory{image->data(), image->size()};
+        int null_fd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+        std::printf("%zu symbols, %.1f MB image\n", count, image->size() / 1e6);
+        std::printf("%8s %12s %12s %12s %14s %8s\n",
+                    "threads", "index (s)", "strtab (s)", "dump (s)", "symbols/s", "speedup");
+
+        double baseline = 0;
+        for(size_t threads=1;threads <= max_threads;threads *= 2){
+                std::unique_ptr<ThreadPool> pool;
+                if( threads > 1 )
+                        pool = std::make_unique<ThreadPool>(threads);
+
+                ElfParser parser;
+                auto pret = parser.Parse(image, memory);
+                auto& elf = *boost::get<ElfFilePtr>(pret);
+
+                auto index = Seconds([&](){ elf.Symbols(pool.get()); });
+                auto strtab = Seconds([&](){
+                        boost::get<StringTable>(elf.sections[opts.sections + 2]).BuildIndex(pool.get());
+                });
+                auto dump = Seconds([&](){
+                        OutputBuffer buffer{null_fd};
+                        JsonWriter out{buffer, JsonStyle::Lines};
+                        DisplayOptions display;
+                        display.pool = pool.get();
+                        PrettyDisplay(elf, out, display);
+                });
+                if( threads == 1 )
+                        baseline = dump;
+                std::printf("%8zu %12.3f %12.3f %12.3f %14.0f %8.2f\n",
+                            threads, index, strtab, dump, count / dump, baseline / dump);
+        }
+        ::close(null_fd);
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,427 @@
+/*
+        Throughput of the individual stages of a dump on a synthetic ELF64
+        image. Every stage prints one JSON object per line, so the output
+        can be appended to a history file as is
+
+                bench_suite --symbols 1000000 --sections 64 >> history.ndjson
+
+        allocations_per_item is the heap allocations of an iteration over
+        its items, zero in builds with CELF_NO_STATS
+ */
+#include "celf/celf.h"
+#include "celf/count_allocations.h"
+#include "bench/synthetic_elf.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <boost/program_options.hpp>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace{
+
+using namespace celf;
+
+// keeps the optimizer from dropping the work of a stage
+volatile std::uint64_t sink;
+
+long PeakRssKb(){
+        struct rusage usage;
+        if( ::getrusage(RUSAGE_SELF, &usage) != 0 )
+                return -1;
+        return usage.ru_maxrss;
+}
+
+struct Stage{
+        const char* name;
+        // input bytes a single iteration reads
+        size_t bytes;
+        // symbols or lookups a single iteration processes
+        size_t items;
+};
+
+class Reporter{
+public:
+        Reporter(bench::SyntheticElfOptions const& opts, size_t image_size, size_t iterations)
+                : opts_(opts), image_size_(image_size), iterations_(iterations)
+        {}
+        template<class F>
+        void Run(Stage const& stage, F const& f){
+                double best = 0;
+                double total = 0;
+                size_t allocations = Allocations().count.load();
+                for(size_t i=0;i!=iterations_;++i){
+                        auto start = std::chrono::steady_clock::now();
+                        f();
+                        auto s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                        best = ( i == 0 ? s : std::min(best, s) );
+                        total += s;
+                }
+                allocations = Allocations().count.load() - allocations;
+                std::printf("{\"benchmark\":\"%s\",\"symbols\":%zu,\"sections\":%zu,\"strtab_bytes\":%zu,"
+                            "\"segments\":%zu,\"seed\":%llu,\"isa\":\"%s\",\"image_bytes\":%zu,\"iterations\":%zu,"
+                            "\"seconds\":%.9f,\"mean_seconds\":%.9f,\"bytes\":%zu,\"mb_per_s\":%.3f,"
+                            "\"items\":%zu,\"items_per_s\":%.1f,\"allocations_per_item\":%.2f,\"peak_rss_kb\":%ld}\n",
+                            stage.name, opts_.symbols, opts_.sections, opts_.strtab_bytes,
+                            opts_.segments, static_cast<unsigned long long>(opts_.seed),
+                            simd::IsaName(simd::DetectIsa()), image_size_, iterations_,
+                            best, total / iterations_, stage.bytes, best > 0 ? stage.bytes / best / 1e6 : 0.0,
+                            stage.items, best > 0 ? stage.items / best : 0.0,
+                            stage.items > 0 ? allocations / double(iterations_ * stage.items) : 0.0, PeakRssKb());
+                std::fflush(stdout);
+        }
+private:
+        bench::SyntheticElfOptions opts_;
+        size_t image_size_;
+        size_t iterations_;
+};
+
+} // end namespace
+
+int main(int argc, char** argv){
+        namespace po = boost::program_options;
+
+        bench::SyntheticElfOptions opts;
+        size_t iterations;
+        size_t lookups;
+        po::options_description desc("Options");
+        desc.add_options()
+                ("help", "print this message")
+                ("symbols", po::value<size_t>(&opts.symbols)->default_value(opts.symbols), "entries in .symtab")
+                ("sections", po::value<size_t>(&opts.sections)->default_value(opts.sections), "SHT_PROGBITS sections")
+                ("strtab-bytes", po::value<size_t>(&opts.strtab_bytes)->default_value(opts.strtab_bytes),
+                                 "minimum size of .strtab, padded with unreferenced strings")
+                ("segments", po::value<size_t>(&opts.segments)->default_value(opts.segments), "PT_LOAD segments")
+                ("compressed-sections", po::value<size_t>(&opts.compressed_sections)->default_value(opts.compressed_sections),
+                                        "zlib SHF_COMPRESSED sections")
+                ("compressed-bytes", po::value<size_t>(&opts.compressed_bytes)->default_value(opts.compressed_bytes),
+                                     "inflated size of each compressed section")
+                ("seed", po::value<std::uint64_t>(&opts.seed)->default_value(opts.seed), "generator seed")
+                ("iterations", po::value<size_t>(&iterations)->default_value(5), "runs of each stage, the best is reported")
+                ("lookups", po::value<size_t>(&lookups)->default_value(100000), "names looked up by name_lookup, and addresses by address_translate")
+        ;
+        po::variables_map vm;
+        try{
+                po::store(po::parse_command_line(argc, argv, desc), vm);
+                po::notify(vm);
+        } catch(po::error const& e){
+                std::cerr << e.what() << "\n";
+                return EXIT_FAILURE;
+        }
+        if( vm.count("help") ){
+                std::cerr << "Syntax: " << argv[0] << " [options]\n" << desc;
+                return EXIT_SUCCESS;
+        }
+        if( opts.sections + 4 > 0xff00 ){
+                std::cerr << "Too many sections\n";
+                return EXIT_FAILURE;
+        }
+        iterations = std::max<size_t>(iterations, 1);
+
+        Allocations().enabled = true;
+        auto image = std::make_shared<std::vector<char> >(bench::MakeSyntheticElf(opts));
+        MemoryView memory{image->data(), image->size()};
+        Reporter report{opts, image->size(), iterations};
+
+        auto pret = ElfParser{}.Parse(image, memory);
+        if( ! boost::get<ElfFilePtr>(&pret) ){
+                std::cerr << "Generated image does not parse: " << ErrorOf(pret) << "\n";
+                return EXIT_FAILURE;
+        }
+        auto& elf = *boost::get<ElfFilePtr>(pret);
+        auto symtab_index = opts.sections + 1;
+        auto strtab_index = opts.sections + 2;
+        auto const& symt = boost::get<SymbolTable>(elf.sections[symtab_index]);
+        auto const& sh_symtab = elf.section_headers[symtab_index];
+        auto const& sh_strtab = elf.section_headers[strtab_index];
+        auto const& sh_shstrtab = elf.section_headers[elf.header.e_shstrndx];
+
+        size_t header_bytes = sizeof(Elf64_Ehdr) + elf.section_headers.size() * sizeof(Elf64_Shdr)
+                            + elf.program_headers.size() * sizeof(Elf64_Phdr);
+        report.Run({"header_parse", header_bytes, elf.section_headers.size()}, [&](){
+                auto ret = ElfParser{}.Parse(image, memory);
+                sink = boost::get<ElfFilePtr>(ret)->sections.size();
+        });
+
+        report.Run({"section_decode", header_bytes + sh_shstrtab.sh_size, elf.section_headers.size()}, [&](){
+                std::uint64_t sum = 0;
+                MaskBuffer flags;
+                for(auto const& sh : elf.section_headers){
+                        sum += ElfSectionType(sh.sh_type).Name().size();
+                        sum += ElfSectionAttributes.MaskToString(sh.sh_flags, flags).size();
+                        sum += elf.SectionName(sh.sh_name).size();
+                }
+                for(auto const& ph : elf.program_headers){
+                        sum += ElfSegmentAttributes.MaskToString(ph.p_flags, flags).size();
+                        sum += ph.p_filesz;
+                }
+                sink = sum;
+        });
+
+        report.Run({"symbol_iteration", sh_symtab.sh_size, symt.size()}, [&](){
+                std::uint64_t sum = 0;
+                for(auto const& sym : symt){
+                        sum += ElfSymbolBinding(sym.Binding()).Name().size();
+                        sum += ElfSymbolTypes(sym.Type()).Name().size();
+                        sum += sym.st_size + sym.IsDefined();
+                }
+                sink = sum;
+        });
+
+        report.Run({"name_resolve", sh_symtab.sh_size + sh_strtab.sh_size, symt.size()}, [&](){
+                std::uint64_t sum = 0;
+                for(auto const& sym : symt)
+                        sum += elf.LookupName(symt.Link(), sym.st_name).size();
+                sink = sum;
+        });
+
+        auto const& strtab = boost::get<StringTable>(elf.sections[strtab_index]);
+        report.Run({"strtab_index", sh_strtab.sh_size, symt.size()}, [&](){
+                sink = strtab.BuildIndex().size();
+        });
+        report.Run({"name_match_substring", sh_strtab.sh_size, symt.size()}, [&](){
+                sink = strtab.MatchNames("6symbol17h00", NameMatch::Substring).ranges.size();
+        });
+        report.Run({"name_match_prefix", sh_strtab.sh_size, symt.size()}, [&](){
+                sink = strtab.MatchNames("_ZN5bench6symbol17h0", NameMatch::Prefix).ranges.size();
+        });
+
+        report.Run({"index_build", sh_symtab.sh_size + sh_strtab.sh_size, symt.size()}, [&](){
+                SymbolIndex index{elf};
+                sink = index.NameCount();
+        });
+
+        std::vector<std::string> names;
+        size_t name_bytes = 0;
+        if( symt.size() > 1 ){
+                lookups = std::max<size_t>(lookups, 1);
+                for(size_t i=0;i!=lookups;++i){
+                        auto const& sym = symt[1 + ( i * 7919 ) % ( symt.size() - 1 )];
+                        names.push_back(elf.LookupName(symt.Link(), sym.st_name).to_string());
+                        name_bytes += names.back().size();
+                }
+        }
+        auto const& index = elf.Symbols();
+        report.Run({"name_lookup", name_bytes, names.size()}, [&](){
+                std::uint64_t found = 0;
+                for(auto const& _ : names)
+                        found += !! index.FindByName(_);
+                sink = found;
+        });
+
+        // every symbol name into one table, then each looked up again
+        report.Run({"name_intern", sh_symtab.sh_size + sh_strtab.sh_size, symt.size()}, [&](){
+                NameInterner interner;
+                interner.Reserve(symt.size());
+                for(size_t idx=1;idx<symt.size();++idx){
+                        auto name = strtab.At(symt[idx].st_name);
+                        interner.Intern(name, GnuHash(name));
+                }
+                std::uint64_t found = 0;
+                for(size_t idx=1;idx<symt.size();++idx){
+                        auto name = strtab.At(symt[idx].st_name);
+                        found += !! interner.Find(name, GnuHash(name));
+                }
+                sink = found + interner.size();
+        });
+
+        // addresses spread over the image and a little past it, so some
+        // are unmapped
+        std::vector<Elf64_Xword> addresses;
+        {
+                Elf64_Xword first = ~Elf64_Xword{0};
+                Elf64_Xword last = 0;
+                for(auto const& ph : elf.program_headers){
+                        first = std::min(first, ToXword(ph.p_vaddr));
+                        last = std::max(last, ToXword(ph.p_vaddr) + ph.p_memsz);
+                }
+                if( first < last ){
+                        std::uint64_t x = opts.seed;
+                        for(size_t i=0;i!=lookups;++i){
+                                x = x * 6364136223846793005ull + 1442695040888963407ull;
+                                addresses.push_back(first + ( x >> 16 ) % ( last - first + 4096 ));
+                        }
+                }
+        }
+        auto const& translator = elf.Addresses();
+        report.Run({"address_translate", addresses.size() * sizeof(Elf64_Xword), addresses.size()}, [&](){
+                sink = translator.Translate(addresses).size();
+        });
+        auto sorted_addresses = addresses;
+        std::sort(sorted_addresses.begin(), sorted_addresses.end());
+        report.Run({"address_translate_sorted", addresses.size() * sizeof(Elf64_Xword), addresses.size()}, [&](){
+                sink = translator.Translate(sorted_addresses).size();
+        });
+
+        // a .rela section with an entry per symbol, against random
+        // symbols of random types
+        std::vector<Elf64_Rela> relas(symt.size());
+        {
+                std::uint64_t x = opts.seed;
+                for(size_t i=0;i!=relas.size();++i){
+                        x = x * 6364136223846793005ull + 1442695040888963407ull;
+                        relas[i].r_offset = ToAddr(i * 8);
+                        relas[i].r_info = ( ( x >> 33 ) % symt.size() ) << 32 | ( ( x >> 20 ) % 42 );
+                        relas[i].r_addend = 0;
+                }
+        }
+        RelocationTable relt{MemoryView{reinterpret_cast<const char*>(relas.data()), relas.size() * sizeof(Elf64_Rela)},
+                             sizeof(Elf64_Rela), SHT_RELA, static_cast<Elf64_Word>(symtab_index), 0};
+        report.Run({"relocation_count", relas.size() * sizeof(Elf64_Rela), relas.size()}, [&](){
+                auto types = relt.CountByType();
+                auto symbols = relt.CountBySymbol(symt.size());
+                sink = types.size() + symbols.back();
+        });
+
+        // the compressed sections inflated whole, one after another and
+        // then over a pool, and in bounded chunks
+        std::vector<size_t> compressed;
+        size_t inflated_bytes = 0;
+        for(size_t i=0;i!=elf.section_headers.size();++i){
+                if( auto chdr = elf.CompressionHeader(i) ){
+                        compressed.push_back(i);
+                        inflated_bytes += chdr->ch_size;
+                }
+        }
+        if( ! compressed.empty() ){
+                report.Run({"decompress", inflated_bytes, compressed.size()}, [&](){
+                        DecompressedSections sections{elf};
+                        sections.DecompressAll(nullptr);
+                        sink = boost::get<MemoryView>(sections.Get(compressed.back())).size();
+                });
+                ThreadPool pool{std::min<size_t>(compressed.size(), std::max(1u, std::thread::hardware_concurrency()))};
+                report.Run({"decompress_parallel", inflated_bytes, compressed.size()}, [&](){
+                        DecompressedSections sections{elf};
+                        sections.DecompressAll(&pool);
+                        sink = boost::get<MemoryView>(sections.Get(compressed.back())).size();
+                });
+                report.Run({"decompress_stream", inflated_bytes, compressed.size()}, [&](){
+                        std::uint64_t sum = 0;
+                        for(auto i : compressed){
+                                StreamSection(elf, i, 64 * 1024, [&](MemoryView chunk){
+                                        sum += chunk.size();
+                                });
+                        }
+                        sink = sum;
+                });
+        }
+
+        // every section and PT_LOAD segment hashed, then over a pool
+        {
+                size_t hashed_bytes = 0;
+                auto hashes = HashContents(elf);
+                for(auto const& _ : hashes.sections)
+                        hashed_bytes += _.size;
+                for(auto const& _ : hashes.segments)
+                        hashed_bytes += _.size;
+                size_t items = hashes.sections.size() + hashes.segments.size();
+                report.Run({"content_hash", hashed_bytes, items}, [&](){
+                        sink = HashContents(elf).fingerprint;
+                });
+                ThreadPool pool{std::max(1u, std::thread::hardware_concurrency())};
+                report.Run({"content_hash_parallel", hashed_bytes, items}, [&](){
+                        sink = HashContents(elf, &pool).fingerprint;
+                });
+        }
+
+        int null_fd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+        report.Run({"json_dump", image->size(), symt.size()}, [&](){
+                OutputBuffer buffer{null_fd};
+                JsonWriter out{buffer, JsonStyle::Pretty};
+                PrettyDisplay(elf, out, DisplayOptions{});
+        });
+        report.Run({"ndjson_dump", image->size(), symt.size()}, [&](){
+                OutputBuffer buffer{null_fd};
+                JsonWriter out{buffer, JsonStyle::Lines};
+                PrettyDisplay(elf, out, DisplayOptions{});
+        });
+        report.Run({"diff", 2 * image->size(), 2 * symt.size()}, [&](){
+                OutputBuffer buffer{null_fd};
+                JsonWriter out{buffer, JsonStyle::Lines};
+                sink = DisplayDiff(elf, elf, out).changed;
+        });
+        ::close(null_fd);
+
+        report.Run({"columnar_export", image->size(), symt.size()}, [&](){
+                ColumnarWriter writer;
+                writer.Add(elf, "synthetic");
+                sink = writer.StringBytes();
+        });
+        char path[] = "/tmp/bench_suite_XXXXXX";
+        int fd = ::mkstemp(path);
+        if( fd == -1 ){
+                std::cerr << "Unable to create a temporary file\n";
+                return EXIT_FAILURE;
+        }
+        ::close(fd);
+
+        // the same file over and over, so this is the system calls and
+        // decoding of a probe with the page cache warm
+        if( ! WriteFileAtomically(path, {memory}) ){
+                ::unlink(path);
+                std::cerr << "Unable to write the image\n";
+                return EXIT_FAILURE;
+        }
+        std::string file = path;
+        // a file mapped, parsed and dropped, the way a batch goes
+        // through a tree. The arena one reuses its arena like a worker
+        size_t files = 100;
+        report.Run({"parse_file", files * image->size(), files}, [&](){
+                std::uint64_t sum = 0;
+                for(size_t i=0;i!=files;++i){
+                        auto ret = ElfParser{}.ParseFile(file);
+                        sum += boost::get<ElfFilePtr>(ret)->sections.size();
+                }
+                sink = sum;
+        });
+        Arena arena;
+        report.Run({"parse_file_arena", files * image->size(), files}, [&](){
+                std::uint64_t sum = 0;
+                for(size_t i=0;i!=files;++i){
+                        {
+                                ElfParser parser;
+                                parser.arena = &arena;
+                                auto ret = parser.ParseFile(file);
+                                sum += boost::get<ElfFilePtr>(ret)->sections.size();
+                        }
+                        arena.Reset();
+                }
+                sink = sum;
+        });
+
+        size_t probes = 1000;
+        report.Run({"probe", probes * ( sizeof(Elf64_Ehdr) + elf.program_headers.size() * sizeof(Elf64_Phdr) ),
+                    probes}, [&](){
+                Prober prober;
+                std::uint64_t sum = 0;
+                for(size_t i=0;i!=probes;++i){
+                        auto ret = prober.ProbeFile(file);
+                        sum += boost::get<ProbeResult>(ret).program_headers.size();
+                }
+                sink = sum;
+        });
+        ColumnarWriter writer;
+        writer.Add(elf, "synthetic");
+        bool written = writer.Write(path);
+        auto cret = ColumnarFile::Open(path);
+        ::unlink(path);
+        if( ! written || ! boost::get<std::shared_ptr<ColumnarFile> >(&cret) ){
+                std::cerr << "Unable to write the columnar export\n";
+                return EXIT_FAILURE;
+        }
+        auto const& columns = *boost::get<std::shared_ptr<ColumnarFile> >(cret);
+        // only the two columns are read
+        report.Run({"columnar_scan", columns.Symbols() * ( sizeof(std::uint8_t) + sizeof(std::uint64_t) ),
+                    columns.Symbols()}, [&](){
+                auto info = columns.Get<std::uint8_t>(Column::SymbolInfo);
+                auto size = columns.Get<std::uint64_t>(Column::SymbolSize);
+                std::uint64_t by_type[16] = {};
+                for(size_t i=0;i!=info.size();++i)
+                        by_type[info[i] & 0xf] += size[i];
+                sink = by_type[STT_FUNC] + by_type[STT_OBJECT];
+        });
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,260 @@
+#pragma once
+
+#include "celf/elf.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#ifndef CELF_NO_ZLIB
+#include <zlib.h>
+#endif
+
+namespace celf{
+namespace bench{
+
+struct SyntheticElfOptions{
+        // SHT_PROGBITS sections besides .symtab, .strtab and .shstrtab
+        size_t sections{16};
+        size_t symbols{100000};
+        // .strtab is padded with unreferenced strings up to this size
+        size_t strtab_bytes{0};
+        // PT_LOAD segments spread over the SHT_PROGBITS sections
+        size_t segments{2};
+        size_t section_bytes{4096};
+        // zlib SHF_COMPRESSED sections after .shstrtab, each inflating
+        // to compressed_bytes of text, none in builds without zlib
+        size_t compressed_sections{4};
+        size_t compressed_bytes{1024 * 1024};
+        std::uint64_t seed{42};
+};
+
+inline std::uint64_t SplitMix64(std::uint64_t& state){
+        std::uint64_t z = ( state += 0x9E3779B97F4A7C15ull );
+        z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ull;
+        z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBull;
+        return z ^ ( z >> 31 );
+}
+
+namespace detail{
+        template<class T>
+        void Append(std::vector<char>& image, T const& value){
+                auto ptr = reinterpret_cast<const char*>(&value);
+                image.insert(image.end(), ptr, ptr + sizeof(T));
+        }
+        inline void Align(std::vector<char>& image, size_t alignment){
+                while( image.size() % alignment != 0 )
+                        image.push_back('\0');
+        }
+        template<class T>
+        void Patch(std::vector<char>& image, size_t offset, T const& value){
+                std::memcpy(image.data() + offset, &value, sizeof(T));
+        }
+} // end namespace detail
+
+/*
+        Deterministic ELF64 image for benchmarks, the same options always
+        give the same bytes. Sections are laid out as
+
+                NULL, .text0 ... .textN, .symtab, .strtab, .shstrtab,
+                .zdebug0 ... .zdebugM
+ */
+inline std::vector<char> MakeSyntheticElf(SyntheticElfOptions const& opts){
+        using detail::Append;
+        using detail::Align;
+        using detail::Patch;
+
+        auto seed = opts.seed;
+        const std::uint64_t base_addr = 0x400000;
+        size_t nsections = opts.sections;
+        size_t nsegments = nsections == 0 ? 0 : std::min(opts.segments, nsections);
+
+        std::vector<char> image(sizeof(Elf64_Ehdr));
+        size_t phoff = image.size();
+        image.resize(image.size() + nsegments * sizeof(Elf64_Phdr));
+
+        std::vector<size_t> section_offsets;
+        for(size_t i=0;i!=nsections;++i){
+                Align(image, 16);
+                section_offsets.push_back(image.size());
+                for(size_t j=0;j!=opts.section_bytes;++j)
+                        image.push_back(static_cast<char>(SplitMix64(seed)));
+        }
+
+        size_t strtab_offset = image.size();
+        std::vector<Elf64_Word> names;
+        image.push_back('\0');
+        char buf[64];
+        for(size_t i=1;i<opts.symbols;++i){
+                names.push_back(static_cast<Elf64_Word>(image.size() - strtab_offset));
+                auto len = std::snprintf(buf, sizeof(buf), "_ZN5bench6symbol17h%016llxE",
+                                         static_cast<unsigned long long>(SplitMix64(seed)));
+                image.insert(image.end(), buf, buf + len + 1);
+        }
+        while( image.size() - strtab_offset < opts.strtab_bytes ){
+                auto len = std::snprintf(buf, sizeof(buf), "filler%016llx",
+                                         static_cast<unsigned long long>(SplitMix64(seed)));
+                image.insert(image.end(), buf, buf + len + 1);
+        }
+        size_t strtab_size = image.size() - strtab_offset;
+
+        Align(image, 8);
+        size_t symtab_offset = image.size();
+        Append(image, Elf64_Sym{});
+        for(size_t i=1;i<opts.symbols;++i){
+                auto r = SplitMix64(seed);
+                static const unsigned char bindings[] = { STB_LOCAL, STB_GLOBAL, STB_GLOBAL, STB_WEAK };
+                static const unsigned char types[] = { STT_FUNC, STT_FUNC, STT_OBJECT, STT_NOTYPE };
+                Elf64_Sym sym{};
+                sym.st_name = names[i-1];
+                sym.st_info = static_cast<unsigned char>(( bindings[r & 3] << 4 ) | types[( r >> 2 ) & 3]);
+                if( nsections == 0 ){
+                        sym.st_shndx = SHN_ABS;
+                        sym.st_value = reinterpret_cast<Elf64_Addr>(base_addr + ( r >> 16 ) % 0x100000);
+                } else {
+                        size_t section = ( r >> 4 ) % nsections;
+                        auto offset = section_offsets[section] + ( r >> 16 ) % std::max<size_t>(opts.section_bytes, 1);
+                        sym.st_shndx = static_cast<Elf64_Half>(1 + section);
+                        sym.st_value = reinterpret_cast<Elf64_Addr>(base_addr + offset);
+                }
+                sym.st_size = ( r >> 40 ) % 256;
+                Append(image, sym);
+        }
+        size_t symtab_size = image.size() - symtab_offset;
+
+        std::string shstrtab{'\0'};
+        std::vector<Elf64_Word> section_names;
+        for(size_t i=0;i!=nsections;++i){
+                section_names.push_back(static_cast<Elf64_Word>(shstrtab.size()));
+                shstrtab += ".text" + std::to_string(i);
+                shstrtab.push_back('\0');
+        }
+        auto add_name = [&](const char* name){
+                auto offset = static_cast<Elf64_Word>(shstrtab.size());
+                shstrtab += name;
+                shstrtab.push_back('\0');
+                return offset;
+        };
+        auto symtab_name = add_name(".symtab");
+        auto strtab_name = add_name(".strtab");
+        auto shstrtab_name = add_name(".shstrtab");
+        size_t ncompressed = 0;
+        std::vector<Elf64_Word> compressed_names;
+#ifndef CELF_NO_ZLIB
+        ncompressed = opts.compressed_sections;
+#endif
+        for(size_t i=0;i!=ncompressed;++i)
+                compressed_names.push_back(add_name(( ".zdebug" + std::to_string(i) ).c_str()));
+        size_t shstrtab_offset = image.size();
+        image.insert(image.end(), shstrtab.begin(), shstrtab.end());
+
+        // text that compresses about as well as DWARF does
+        std::vector<std::pair<size_t, size_t> > compressed;
+#ifndef CELF_NO_ZLIB
+        for(size_t i=0;i!=ncompressed;++i){
+                std::string text;
+                while( text.size() < opts.compressed_bytes ){
+                        auto len = std::snprintf(buf, sizeof(buf), "DW_TAG_variable %llu at 0x%llx\n",
+                                                 static_cast<unsigned long long>(SplitMix64(seed) % 1000),
+                                                 static_cast<unsigned long long>(SplitMix64(seed) % 0x10000));
+                        text.append(buf, len);
+                }
+                text.resize(opts.compressed_bytes);
+                uLongf size = ::compressBound(text.size());
+                std::vector<char> payload(size);
+                ::compress2(reinterpret_cast<Bytef*>(payload.data()), &size,
+                            reinterpret_cast<const Bytef*>(text.data()), text.size(), Z_DEFAULT_COMPRESSION);
+                Align(image, 8);
+                compressed.emplace_back(image.size(), sizeof(Elf64_Chdr) + size);
+                Elf64_Chdr chdr{};
+                chdr.ch_type = ELFCOMPRESS_ZLIB;
+                chdr.ch_size = text.size();
+                chdr.ch_addralign = 1;
+                Append(image, chdr);
+                image.insert(image.end(), payload.begin(), payload.begin() + size);
+        }
+#endif
+
+        Align(image, 8);
+        size_t shoff = image.size();
+        Append(image, Elf64_Shdr{});
+        for(size_t i=0;i!=nsections;++i){
+                Elf64_Shdr sh{};
+                sh.sh_name = section_names[i];
+                sh.sh_type = SHT_PROGBITS;
+                sh.sh_flags = 0x2 | 0x4;
+                sh.sh_addr = reinterpret_cast<Elf64_Addr>(base_addr + section_offsets[i]);
+                sh.sh_offset = section_offsets[i];
+                sh.sh_size = opts.section_bytes;
+                sh.sh_addralign = 16;
+                Append(image, sh);
+        }
+        Elf64_Shdr sh{};
+        sh.sh_name = symtab_name;
+        sh.sh_type = SHT_SYMTAB;
+        sh.sh_offset = symtab_offset;
+        sh.sh_size = symtab_size;
+        sh.sh_link = static_cast<Elf64_Word>(nsections + 2);
+        sh.sh_info = 1;
+        sh.sh_addralign = 8;
+        sh.sh_entsize = sizeof(Elf64_Sym);
+        Append(image, sh);
+        sh = Elf64_Shdr{};
+        sh.sh_name = strtab_name;
+        sh.sh_type = SHT_STRTAB;
+        sh.sh_offset = strtab_offset;
+        sh.sh_size = strtab_size;
+        sh.sh_addralign = 1;
+        Append(image, sh);
+        sh.sh_name = shstrtab_name;
+        sh.sh_offset = shstrtab_offset;
+        sh.sh_size = shstrtab.size();
+        Append(image, sh);
+        for(size_t i=0;i!=compressed.size();++i){
+                sh = Elf64_Shdr{};
+                sh.sh_name = compressed_names[i];
+                sh.sh_type = SHT_PROGBITS;
+                sh.sh_flags = SHF_COMPRESSED;
+                sh.sh_offset = compressed[i].first;
+                sh.sh_size = compressed[i].second;
+                sh.sh_addralign = 8;
+                Append(image, sh);
+        }
+
+        for(size_t i=0;i!=nsegments;++i){
+                size_t first = i * nsections / nsegments;
+                size_t last = ( i + 1 ) * nsections / nsegments;
+                Elf64_Phdr ph{};
+                ph.p_type = 1;
+                ph.p_flags = 0x4 | 0x1;
+                ph.p_offset = section_offsets[first];
+                ph.p_vaddr = reinterpret_cast<Elf64_Addr>(base_addr + ph.p_offset);
+                ph.p_paddr = ph.p_vaddr;
+                ph.p_filesz = section_offsets[last-1] + opts.section_bytes - ph.p_offset;
+                ph.p_memsz = ph.p_filesz;
+                ph.p_align = 16;
+                Patch(image, phoff + i * sizeof(Elf64_Phdr), ph);
+        }
+
+        Elf64_Ehdr header{};
+        std::memcpy(header.e_ident, "\x7f" "ELF", 4);
+        header.e_ident[EI_CLASS] = ELFCLASS64;
+        header.e_ident[EI_DATA] = ELFDATA2LSB;
+        header.e_ident[EI_VERSION] = 1;
+        header.e_type = nsegments ? 2 : 1;
+        header.e_machine = 62;
+        header.e_version = 1;
+        header.e_phoff = nsegments ? phoff : 0;
+        header.e_shoff = shoff;
+        header.e_ehsize = sizeof(Elf64_Ehdr);
+        header.e_phentsize = sizeof(Elf64_Phdr);
+        header.e_phnum = static_cast<Elf64_Half>(nsegments);
+        header.e_shentsize = sizeof(Elf64_Shdr);
+        header.e_shnum = static_cast<Elf64_Half>(nsections + 4 + compressed.size());
+        header.e_shstrndx = static_cast<Elf64_Half>(nsections + 3);
+        Patch(image, 0, header);
+        return image;
+}
+
+} // end namespace bench
+} // end namespace celf
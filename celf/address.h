@@ -0,0 +1,223 @@
+#pragma once
+
+#include "celf/elf_file.h"
+#include "celf/json.h"
+
+#include <vector>
+#include <algorithm>
+#include <boost/optional.hpp>
+
+namespace celf{
+
+/*
+        Where a virtual address of the loaded image comes from. Segment
+        and section are indices into the program and section header
+        tables
+ */
+struct Translation{
+        Elf64_Xword address;
+        // PT_LOAD segment containing it, none when unmapped
+        boost::optional<Elf64_Word> segment;
+        // SHF_ALLOC section containing it
+        boost::optional<Elf64_Word> section;
+        // none when unmapped, or in the zero filled tail of the segment
+        boost::optional<Elf64_Off> offset;
+
+        bool Mapped()const{ return !! segment; }
+};
+
+namespace address_detail{
+
+/*
+        Address ranges sorted by start, each with the running maximum of
+        the ends so far, so ranges that overlap are found by walking back
+        from the last one starting at or before the address, the same way
+        SymbolIndex finds symbols
+ */
+class RangeTable{
+public:
+        void Add(Elf64_Xword start, Elf64_Xword size, Elf64_Word value){
+                if( size == 0 || start + size < start )
+                        return;
+                pending_.push_back(Entry{start, start + size, 0, value});
+        }
+        void Build(){
+                std::stable_sort(pending_.begin(), pending_.end(), [](Entry const& l, Entry const& r){
+                        return l.start < r.start;
+                });
+                starts_.reserve(pending_.size());
+                Elf64_Xword max_end = 0;
+                for(auto& _ : pending_){
+                        max_end = std::max(max_end, _.end);
+                        _.max_end = max_end;
+                        starts_.push_back(_.start);
+                }
+                entries_ = std::move(pending_);
+                pending_.clear();
+        }
+
+        // number of ranges starting at or before addr
+        size_t UpperBound(Elf64_Xword addr)const{
+                return std::upper_bound(starts_.begin(), starts_.end(), addr) - starts_.begin();
+        }
+        // UpperBound for an addr no smaller than the one pos came from,
+        // galloping forward so a run of sorted addresses costs a pass
+        // over the table rather than a search each
+        size_t Advance(size_t pos, Elf64_Xword addr)const{
+                size_t step = 1;
+                size_t last = pos;
+                while( last < starts_.size() && starts_[last] <= addr ){
+                        pos = last + 1;
+                        last = pos + step;
+                        step *= 2;
+                }
+                last = std::min(last, starts_.size());
+                return std::upper_bound(starts_.begin() + pos, starts_.begin() + last, addr) - starts_.begin();
+        }
+        // the last range before pos that contains addr
+        boost::optional<Elf64_Word> FindBefore(size_t pos, Elf64_Xword addr)const{
+                while( pos != 0 ){
+                        auto const& e = entries_[--pos];
+                        if( e.max_end <= addr )
+                                break;
+                        if( e.end > addr )
+                                return e.value;
+                }
+                return boost::none;
+        }
+        boost::optional<Elf64_Word> Find(Elf64_Xword addr)const{
+                return FindBefore(UpperBound(addr), addr);
+        }
+
+        size_t size()const{ return entries_.size(); }
+        size_t HeapBytes()const{
+                return ( pending_.capacity() + entries_.capacity() ) * sizeof(Entry) +
+                       starts_.capacity() * sizeof(Elf64_Xword);
+        }
+private:
+        struct Entry{
+                Elf64_Xword start;
+                Elf64_Xword end;
+                Elf64_Xword max_end;
+                Elf64_Word value;
+        };
+        std::vector<Entry> pending_;
+        // searched on their own so a lookup only touches the starts
+        std::vector<Elf64_Xword> starts_;
+        std::vector<Entry> entries_;
+};
+
+} // end namespace address_detail
+
+/*
+        Maps virtual addresses of the loaded image to the PT_LOAD segment,
+        SHF_ALLOC section and file offset they come from. Built once per
+        file, a lookup is a binary search over the segment starts and one
+        over the section starts, and a batch of sorted addresses is a
+        single forward pass over both. Nothing refers back to the
+        ElfFile, so it can be kept after the file is gone.
+
+        Sections that take no address space, thread local SHT_NOBITS ones
+        such as .tbss, are left out
+ */
+class AddressTranslator{
+public:
+        explicit AddressTranslator(ElfFile const& elf){
+                for(size_t i=0;i!=elf.program_headers.size();++i){
+                        auto ph = elf.program_headers[i];
+                        if( ph.p_type != PT_LOAD )
+                                continue;
+                        segments_.Add(ToXword(ph.p_vaddr), ph.p_memsz, static_cast<Elf64_Word>(loads_.size()));
+                        loads_.push_back(Load{ToXword(ph.p_vaddr), ph.p_offset, ph.p_filesz, static_cast<Elf64_Word>(i)});
+                }
+                for(size_t i=0;i!=elf.section_headers.size();++i){
+                        auto sh = elf.section_headers[i];
+                        if( ! ( sh.sh_flags & SHF_ALLOC ) )
+                                continue;
+                        if( sh.sh_type == SHT_NOBITS && ( sh.sh_flags & SHF_TLS ) )
+                                continue;
+                        sections_.Add(ToXword(sh.sh_addr), sh.sh_size, static_cast<Elf64_Word>(i));
+                }
+                segments_.Build();
+                sections_.Build();
+        }
+
+        Translation Translate(Elf64_Xword address)const{
+                return Make(address, segments_.Find(address), sections_.Find(address));
+        }
+        // one translation per address, in order
+        std::vector<Translation> Translate(std::vector<Elf64_Xword> const& addresses)const{
+                std::vector<Translation> result;
+                result.reserve(addresses.size());
+                if( ! std::is_sorted(addresses.begin(), addresses.end()) ){
+                        for(auto _ : addresses)
+                                result.push_back(Translate(_));
+                        return result;
+                }
+                size_t segment_pos = 0;
+                size_t section_pos = 0;
+                for(auto _ : addresses){
+                        segment_pos = segments_.Advance(segment_pos, _);
+                        section_pos = sections_.Advance(section_pos, _);
+                        result.push_back(Make(_, segments_.FindBefore(segment_pos, _),
+                                                 sections_.FindBefore(section_pos, _)));
+                }
+                return result;
+        }
+
+        size_t SegmentCount()const{ return segments_.size(); }
+        size_t SectionCount()const{ return sections_.size(); }
+        size_t HeapBytes()const{
+                return loads_.capacity() * sizeof(Load) + segments_.HeapBytes() + sections_.HeapBytes();
+        }
+private:
+        struct Load{
+                Elf64_Xword vaddr;
+                Elf64_Off offset;
+                Elf64_Xword filesz;
+                // in the program header table
+                Elf64_Word index;
+        };
+
+        Translation Make(Elf64_Xword address, boost::optional<Elf64_Word> load,
+                         boost::optional<Elf64_Word> section)const{
+                Translation result;
+                result.address = address;
+                result.section = section;
+                if( load ){
+                        auto const& seg = loads_[*load];
+                        result.segment = seg.index;
+                        if( address - seg.vaddr < seg.filesz )
+                                result.offset = seg.offset + ( address - seg.vaddr );
+                }
+                return result;
+        }
+
+        std::vector<Load> loads_;
+        address_detail::RangeTable segments_;
+        address_detail::RangeTable sections_;
+};
+
+inline AddressTranslator const& ElfFile::Addresses()const{
+        std::call_once(addresses_once_, [this](){
+                addresses_ = std::make_shared<AddressTranslator>(*this);
+        });
+        return *addresses_;
+}
+
+inline void DisplayTranslation(ElfFile const& elf, Translation const& t, JsonWriter& out){
+        out.BeginRecord("address");
+        out.Field("address", ToAddr(t.address));
+        out.Field("mapped", (int)t.Mapped());
+        if( t.segment )
+                out.Field("segment", *t.segment);
+        if( t.section ){
+                out.Field("section", *t.section);
+                out.Field("section_name", elf.SectionName(elf.section_headers[*t.section].sh_name));
+        }
+        if( t.offset )
+                out.Field("offset", *t.offset);
+        out.EndRecord();
+}
+
+} // end namespace celf
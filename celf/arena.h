@@ -0,0 +1,187 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <algorithm>
+#include <vector>
+
+namespace celf{
+
+/*
+        Monotonic allocator, memory is handed out from large blocks and
+        only given back all at once by Reset. Reset keeps one block the
+        size of everything that was used, so an arena reused for one file
+        after another stops touching the heap once it has seen the
+        largest file.
+
+        Not thread safe, every worker has its own
+ */
+class Arena{
+public:
+        explicit Arena(size_t block_size = 64 * 1024):block_size_{block_size}{}
+        ~Arena(){
+                Free();
+        }
+        Arena(Arena const&)=delete;
+        Arena& operator=(Arena const&)=delete;
+
+        void* Allocate(size_t size, size_t align){
+                auto first = ( reinterpret_cast<std::uintptr_t>(ptr_) + align - 1 ) & ~std::uintptr_t(align - 1);
+                if( ! head_ || first + size > reinterpret_cast<std::uintptr_t>(end_) ){
+                        Grow(size + align);
+                        first = ( reinterpret_cast<std::uintptr_t>(ptr_) + align - 1 ) & ~std::uintptr_t(align - 1);
+                }
+                used_ += first + size - reinterpret_cast<std::uintptr_t>(ptr_);
+                ptr_ = reinterpret_cast<char*>(first + size);
+                return reinterpret_cast<void*>(first);
+        }
+        // everything allocated so far is gone, nothing is destroyed
+        void Reset(){
+                if( head_ && head_->next ){
+                        size_t total = 0;
+                        for(auto block = head_; block; block = block->next)
+                                total += block->size;
+                        Free();
+                        Grow(total);
+                }
+                if( head_ ){
+                        ptr_ = head_->Data();
+                        end_ = ptr_ + head_->size;
+                }
+                used_ = 0;
+        }
+
+        // bytes handed out since the last Reset, with alignment padding
+        size_t Used()const{ return used_; }
+        size_t Blocks()const{
+                size_t count = 0;
+                for(auto block = head_; block; block = block->next)
+                        ++count;
+                return count;
+        }
+private:
+        struct Block{
+                Block* next;
+                size_t size;
+                char* Data(){ return reinterpret_cast<char*>(this + 1); }
+        };
+        static_assert(sizeof(Block) % alignof(std::max_align_t) == 0, "blocks must keep data aligned");
+
+        void Grow(size_t at_least){
+                size_t size = std::max(at_least, block_size_);
+                auto block = static_cast<Block*>(::operator new(sizeof(Block) + size));
+                block->next = head_;
+                block->size = size;
+                head_ = block;
+                ptr_ = block->Data();
+                end_ = ptr_ + size;
+        }
+        void Free(){
+                while( head_ ){
+                        auto next = head_->next;
+                        ::operator delete(head_);
+                        head_ = next;
+                }
+                ptr_ = end_ = nullptr;
+        }
+
+        size_t block_size_;
+        Block* head_{nullptr};
+        char* ptr_{nullptr};
+        char* end_{nullptr};
+        size_t used_{0};
+};
+
+/*
+        An arena from the calling thread's free list, given back reset when
+        the lease ends. A thread can be inside more than one file at a
+        time, a worker waiting on a TaskGroup runs other queued tasks, so
+        each file takes its own arena rather than sharing one per thread
+ */
+class ArenaLease{
+public:
+        ArenaLease(){
+                auto& free = FreeList();
+                if( free.empty() ){
+                        arena_ = std::make_unique<Arena>();
+                } else {
+                        arena_ = std::move(free.back());
+                        free.pop_back();
+                }
+        }
+        ~ArenaLease(){
+                arena_->Reset();
+                FreeList().push_back(std::move(arena_));
+        }
+        ArenaLease(ArenaLease const&)=delete;
+        ArenaLease& operator=(ArenaLease const&)=delete;
+
+        Arena* get()const{ return arena_.get(); }
+private:
+        static std::vector<std::unique_ptr<Arena> >& FreeList(){
+                thread_local std::vector<std::unique_ptr<Arena> > list;
+                return list;
+        }
+
+        std::unique_ptr<Arena> arena_;
+};
+
+/*
+        Standard allocator over an Arena, or the global heap when it has
+        none, so the same container type works both ways
+ */
+template<class T>
+struct ArenaAllocator{
+        using value_type = T;
+
+        ArenaAllocator()=default;
+        explicit ArenaAllocator(Arena* arena):arena{arena}{}
+        template<class U>
+        ArenaAllocator(ArenaAllocator<U> const& that):arena{that.arena}{}
+
+        T* allocate(size_t n){
+                if( arena )
+                        return static_cast<T*>(arena->Allocate(n * sizeof(T), alignof(T)));
+                return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+        void deallocate(T* ptr, size_t n){
+                if( ! arena )
+                        ::operator delete(ptr);
+        }
+
+        Arena* arena{nullptr};
+};
+
+template<class T, class U>
+bool operator==(ArenaAllocator<T> const& l, ArenaAllocator<U> const& r){ return l.arena == r.arena; }
+template<class T, class U>
+bool operator!=(ArenaAllocator<T> const& l, ArenaAllocator<U> const& r){ return l.arena != r.arena; }
+
+// deleter for objects that were constructed in an Arena, or with new
+template<class T>
+struct ArenaDelete{
+        ArenaDelete()=default;
+        explicit ArenaDelete(Arena* arena):arena{arena}{}
+
+        void operator()(T* ptr)const{
+                if( arena )
+                        ptr->~T();
+                else
+                        delete ptr;
+        }
+
+        Arena* arena{nullptr};
+};
+
+// constructs a T in arena, or with new when there is none
+template<class T, class... Args>
+std::unique_ptr<T, ArenaDelete<T> > ArenaNew(Arena* arena, Args&&... args){
+        if( ! arena )
+                return std::unique_ptr<T, ArenaDelete<T> >{new T(std::forward<Args>(args)...)};
+        void* ptr = arena->Allocate(sizeof(T), alignof(T));
+        return std::unique_ptr<T, ArenaDelete<T> >{new(ptr) T(std::forward<Args>(args)...), ArenaDelete<T>{arena}};
+}
+
+} // end namespace celf
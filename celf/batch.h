@@ -0,0 +1,175 @@
+#pragma once
+
+#include "celf/elf_file.h"
+#include "celf/json.h"
+#include "celf/thread_pool.h"
+#include "celf/probe.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <istream>
+#include <iostream>
+#include <algorithm>
+#include <boost/filesystem.hpp>
+
+namespace celf{
+
+struct BatchInput{
+        std::string filename;
+        // found by walking a directory rather than named by the user, non
+        // ELF files are skipped quietly
+        bool discovered;
+};
+
+struct BatchOptions{
+        size_t jobs{1};
+        // files parsed or waiting to be written at any one time
+        size_t max_open{1};
+        JsonStyle style{JsonStyle::Pretty};
+        // also split large files across the pool, see DisplayOptions
+        bool split_files{false};
+        // records the phases of every file when set
+        Stats* stats{nullptr};
+        // renders a parsed file instead of PrettyDisplay when set
+        std::function<void(ElfFile const&, JsonWriter&)> render;
+        // only what it selects is parsed and written when set
+        Filter const* filter{nullptr};
+        // writes DisplayProbe of every file instead of parsing it
+        bool probe{false};
+};
+
+/*
+        Expands directories recursively, each directory's files are sorted
+        so the output order doesn't depend on the filesystem
+ */
+inline void CollectInputs(std::string const& name, bool discovered, std::vector<BatchInput>& result){
+        namespace fs = boost::filesystem;
+        boost::system::error_code ec;
+        if( ! fs::is_directory(name, ec) ){
+                result.push_back(BatchInput{name, discovered});
+                return;
+        }
+        std::vector<std::string> files;
+        for(fs::recursive_directory_iterator iter{name, ec}, end; ! ec && iter != end; iter.increment(ec)){
+                if( fs::is_regular_file(iter->symlink_status()) )
+                        files.push_back(iter->path().string());
+        }
+        std::sort(files.begin(), files.end());
+        for(auto& _ : files)
+                result.push_back(BatchInput{std::move(_), true});
+}
+
+inline void ReadFileList(std::istream& is, std::vector<BatchInput>& result){
+        std::string line;
+        while( std::getline(is, line) ){
+                if( ! line.empty() )
+                        CollectInputs(line, false, result);
+        }
+}
+
+/*
+        Parses and renders every input on the pool, and writes the results
+        to stdout in input order. Only max_open files are in flight, which
+        bounds both the number of mappings and the buffered output.
+ */
+inline bool RunBatch(std::vector<BatchInput> const& inputs, BatchOptions const& opts){
+        struct Slot{
+                std::string output;
+                std::string error;
+                bool done{false};
+        };
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::deque<std::shared_ptr<Slot> > window;
+        bool ok = true;
+
+        ThreadPool pool{opts.jobs};
+        DisplayOptions display;
+        if( opts.split_files )
+                display.pool = &pool;
+        display.stats = opts.stats;
+        OutputBuffer stdout_buffer{STDOUT_FILENO};
+        size_t next_submit = 0;
+        size_t max_open = std::max<size_t>(opts.max_open, 1);
+
+        while( next_submit != inputs.size() || ! window.empty() ){
+                for(; next_submit != inputs.size() && window.size() < max_open; ++next_submit){
+                        auto slot = std::make_shared<Slot>();
+                        window.push_back(slot);
+                        auto const& input = inputs[next_submit];
+                        pool.Post([&input, slot, &opts, &display, &mtx, &cv](){
+                                std::string output;
+                                std::string error;
+                                bool not_elf = false;
+                                try{
+                                        if( opts.probe ){
+                                                // one per worker, its buffers outlive the file
+                                                thread_local Prober prober;
+                                                prober.stats = opts.stats;
+                                                auto pret = prober.ProbeFile(input.filename);
+                                                if( auto ptr = boost::get<ProbeResult>(&pret) ){
+                                                        OutputBuffer buffer;
+                                                        JsonWriter out{buffer, opts.style};
+                                                        out.SetFile(input.filename);
+                                                        DisplayProbe(*ptr, out);
+                                                        output = buffer.Take();
+                                                } else {
+                                                        not_elf = ( boost::get<NotElf>(&pret) != nullptr );
+                                                        error = ErrorOf(pret);
+                                                }
+                                        } else {
+                                                // the file is gone before the lease gives the
+                                                // arena back, even when rendering throws
+                                                ArenaLease arena;
+                                                ElfParser parser;
+                                                parser.stats = opts.stats;
+                                                parser.filter = opts.filter;
+                                                parser.arena = arena.get();
+                                                auto pret = parser.ParseFile(input.filename);
+                                                if( auto ptr = boost::get<ElfFilePtr>(&pret) ){
+                                                        OutputBuffer buffer;
+                                                        JsonWriter out{buffer, opts.style};
+                                                        out.SetFile(input.filename);
+                                                        if( opts.render )
+                                                                opts.render(**ptr, out);
+                                                        else
+                                                                PrettyDisplay(**ptr, out, display);
+                                                        output = buffer.Take();
+                                                } else {
+                                                        not_elf = ( boost::get<NotElf>(&pret) != nullptr );
+                                                        error = ErrorOf(pret);
+                                                }
+                                        }
+                                        if( input.discovered && not_elf )
+                                                error.clear();
+                                } catch(std::exception const& e){
+                                        error = e.what();
+                                }
+                                std::lock_guard<std::mutex> lock(mtx);
+                                slot->output = std::move(output);
+                                slot->error = std::move(error);
+                                slot->done = true;
+                                cv.notify_all();
+                        });
+                }
+
+                auto slot = window.front();
+                {
+                        std::unique_lock<std::mutex> lock(mtx);
+                        cv.wait(lock, [&](){ return slot->done; });
+                }
+                size_t idx = next_submit - window.size();
+                if( ! slot->error.empty() ){
+                        stdout_buffer.Flush();
+                        std::cerr << inputs[idx].filename << ": " << slot->error << "\n";
+                        ok = false;
+                }
+                stdout_buffer.Write(slot->output);
+                window.pop_front();
+        }
+        return ok;
+}
+
+} // end namespace celf
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "celf/elf.h"
+#include "celf/memory.h"
+#include "celf/simd.h"
+#include "celf/filter.h"
+#include "celf/elf_file.h"
+#include "celf/stream.h"
+#include "celf/symbol_index.h"
+#include "celf/address.h"
+#include "celf/notes.h"
+#include "celf/compressed.h"
+#include "celf/hash.h"
+#include "celf/index_cache.h"
+#include "celf/columnar.h"
+#include "celf/json.h"
+#include "celf/diff.h"
+#include "celf/server.h"
+#include "celf/probe.h"
+#include "celf/resolver.h"
+#include "celf/thread_pool.h"
+#include "celf/batch.h"
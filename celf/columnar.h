@@ -0,0 +1,334 @@
+#pragma once
+
+#include "celf/elf_file.h"
+#include "celf/symbol_index.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include <boost/variant.hpp>
+#include <boost/utility/string_view.hpp>
+
+namespace celf{
+
+/*
+        Binary export of the symbol tables of many files, laid out for
+        analytics jobs rather than for reading
+
+                header | column | column | ...
+
+        Every field is its own contiguous array, 8 byte aligned, so a
+        reader that sums st_size by type only pages in the info and size
+        columns. Names are offsets into one string blob in which every
+        distinct name is stored once. The ELF header of every file and the
+        raw header of every section are kept alongside. Arrays are in the
+        native layout, same as the index cache.
+ */
+enum class Column : std::uint32_t{
+        // NUL terminated names, offset 0 is the empty name
+        Strings,
+        // per file
+        FilePath,       // uint32, offset in Strings
+        FileHeader,     // Elf64_Ehdr
+        // per section
+        SectionHeader,  // Elf64_Shdr
+        SectionName,    // uint32, offset in Strings
+        SectionFile,    // uint32
+        // per symbol
+        SymbolName,     // uint32, offset in Strings
+        SymbolValue,    // uint64
+        SymbolSize,     // uint64
+        SymbolInfo,     // uint8
+        SymbolShndx,    // uint32, SHN_XINDEX resolved
+        SymbolTable,    // uint32, section index of the table
+        SymbolFile,     // uint32
+        Count,
+};
+
+namespace columnar_detail{
+
+static constexpr std::uint64_t Version = 3;
+inline const char* Magic(){ return "CELFCOL"; }
+
+struct Array{
+        std::uint64_t offset;
+        std::uint64_t count;
+        std::uint64_t size; // of an element
+};
+struct Header{
+        char magic[8];
+        std::uint64_t version;
+        Array columns[static_cast<size_t>(Column::Count)];
+};
+
+} // end namespace columnar_detail
+
+/*
+        Collects files one at a time and writes the container at the end.
+        Symbols go straight from the SymbolTable into the columns, and a
+        file parsed with a Filter only contributes what it selected
+ */
+class ColumnarWriter{
+public:
+        ColumnarWriter(){
+                slots_.resize(1024);
+                strings_.push_back('\0');
+        }
+
+        // returns the id of the file in the File* columns
+        std::uint32_t Add(ElfFile const& elf, boost::string_view path){
+                auto file = static_cast<std::uint32_t>(file_path_.size());
+                file_path_.push_back(Intern(path));
+                file_header_.push_back(elf.header);
+
+                auto const* filter = elf.filter.get();
+                for(size_t i=0;i!=elf.section_headers.size();++i){
+                        if( filter && ! filter->ShowSection(i) )
+                                continue;
+                        auto const& sh = elf.section_headers[i];
+                        section_header_.push_back(sh);
+                        section_name_.push_back(Intern(NameOr(elf, elf.NameSectionIndex(), sh.sh_name)));
+                        section_file_.push_back(file);
+
+                        auto symt = boost::get<celf::SymbolTable>(&elf.sections[i]);
+                        if( ! symt )
+                                continue;
+                        Reserve(symbol_name_.size() + symt->size());
+                        for(auto const& sym : *symt){
+                                if( filter && ! filter->ShowSymbol(elf, *symt, sym) )
+                                        continue;
+                                symbol_name_.push_back(sym.st_name == 0 ? 0 : Intern(NameOr(elf, symt->Link(), sym.st_name)));
+                                symbol_value_.push_back(ToXword(sym.st_value));
+                                symbol_size_.push_back(sym.st_size);
+                                symbol_info_.push_back(sym.st_info);
+                                symbol_shndx_.push_back(sym.SectionIndex());
+                                symbol_table_.push_back(static_cast<std::uint32_t>(i));
+                                symbol_file_.push_back(file);
+                        }
+                }
+                return file;
+        }
+
+        size_t Files()const{ return file_path_.size(); }
+        size_t Symbols()const{ return symbol_name_.size(); }
+        size_t StringBytes()const{ return strings_.size(); }
+
+        // written to a temporary file and renamed into place, errno is
+        // left set on failure
+        bool Write(std::string const& path)const{
+                using namespace columnar_detail;
+                Header header{};
+                std::memcpy(header.magic, Magic(), sizeof(header.magic));
+                header.version = Version;
+
+                static const char padding[8] = {};
+                std::vector<MemoryView> parts;
+                parts.emplace_back(reinterpret_cast<const char*>(&header), sizeof(header));
+                size_t offset = sizeof(header);
+                auto append = [&](Column column, const void* data, size_t count, size_t size){
+                        size_t aligned = ( offset + 7 ) & ~size_t{7};
+                        if( aligned != offset )
+                                parts.emplace_back(padding, aligned - offset);
+                        header.columns[static_cast<size_t>(column)] = Array{aligned, count, size};
+                        parts.emplace_back(static_cast<const char*>(data), count * size);
+                        offset = aligned + count * size;
+                };
+                auto column = [&](Column id, auto const& values){
+                        append(id, values.data(), values.size(), sizeof(values[0]));
+                };
+                append(Column::Strings, strings_.data(), strings_.size(), 1);
+                column(Column::FilePath, file_path_);
+                column(Column::FileHeader, file_header_);
+                column(Column::SectionHeader, section_header_);
+                column(Column::SectionName, section_name_);
+                column(Column::SectionFile, section_file_);
+                column(Column::SymbolName, symbol_name_);
+                column(Column::SymbolValue, symbol_value_);
+                column(Column::SymbolSize, symbol_size_);
+                column(Column::SymbolInfo, symbol_info_);
+                column(Column::SymbolShndx, symbol_shndx_);
+                column(Column::SymbolTable, symbol_table_);
+                column(Column::SymbolFile, symbol_file_);
+                return WriteFileAtomically(path, parts);
+        }
+private:
+        // a damaged name is exported as the empty one rather than
+        // failing the whole export
+        static boost::string_view NameOr(ElfFile const& elf, Elf64_Word index, Elf64_Word offset){
+                try{
+                        return elf.LookupName(index, offset);
+                } catch(std::exception const&){
+                        return boost::string_view{};
+                }
+        }
+        void Reserve(size_t symbols){
+                if( symbols <= symbol_name_.capacity() )
+                        return;
+                symbols = std::max(symbols, 2 * symbol_name_.capacity());
+                symbol_name_.reserve(symbols);
+                symbol_value_.reserve(symbols);
+                symbol_size_.reserve(symbols);
+                symbol_info_.reserve(symbols);
+                symbol_shndx_.reserve(symbols);
+                symbol_table_.reserve(symbols);
+                symbol_file_.reserve(symbols);
+        }
+
+        // open addressing over offsets into strings_, so the blob is
+        // the only copy of each name
+        std::uint32_t Intern(boost::string_view s){
+                if( s.empty() )
+                        return 0;
+                auto h = GnuHash(s);
+                size_t mask = slots_.size() - 1;
+                size_t pos = h & mask;
+                for(; slots_[pos].offset != 0; pos = ( pos + 1 ) & mask){
+                        auto const& slot = slots_[pos];
+                        if( slot.hash == h && std::strncmp(strings_.data() + slot.offset, s.data(), s.size()) == 0 &&
+                            strings_[slot.offset + s.size()] == '\0' )
+                                return slot.offset;
+                }
+                if( strings_.size() + s.size() + 1 > 0xffffffffu )
+                        throw std::length_error("columnar string blob over 4GB");
+                auto offset = static_cast<std::uint32_t>(strings_.size());
+                strings_.append(s.data(), s.size());
+                strings_.push_back('\0');
+                slots_[pos] = Slot{h, offset};
+                if( ++interned_ * 2 > slots_.size() )
+                        Grow();
+                return offset;
+        }
+        void Grow(){
+                std::vector<Slot> slots(slots_.size() * 2);
+                size_t mask = slots.size() - 1;
+                for(auto const& _ : slots_){
+                        if( _.offset == 0 )
+                                continue;
+                        size_t pos = _.hash & mask;
+                        for(; slots[pos].offset != 0; pos = ( pos + 1 ) & mask);
+                        slots[pos] = _;
+                }
+                slots_.swap(slots);
+        }
+
+        struct Slot{
+                std::uint32_t hash;
+                // 0 is free, the empty name is never stored
+                std::uint32_t offset;
+        };
+        std::string strings_;
+        std::vector<Slot> slots_;
+        size_t interned_{0};
+
+        std::vector<std::uint32_t> file_path_;
+        std::vector<Elf64_Ehdr> file_header_;
+        std::vector<Elf64_Shdr> section_header_;
+        std::vector<std::uint32_t> section_name_;
+        std::vector<std::uint32_t> section_file_;
+        std::vector<std::uint32_t> symbol_name_;
+        std::vector<std::uint64_t> symbol_value_;
+        std::vector<std::uint64_t> symbol_size_;
+        std::vector<std::uint8_t> symbol_info_;
+        std::vector<std::uint32_t> symbol_shndx_;
+        std::vector<std::uint32_t> symbol_table_;
+        std::vector<std::uint32_t> symbol_file_;
+};
+
+// one column of a ColumnarFile, borrowed from its mapping
+template<class T>
+struct ColumnView{
+        ColumnView(const T* data, size_t size):data_{data}, size_{size}{}
+
+        const T* data()const{ return data_; }
+        size_t size()const{ return size_; }
+        bool empty()const{ return size_ == 0; }
+        const T* begin()const{ return data_; }
+        const T* end()const{ return data_ + size_; }
+        T const& operator[](size_t idx)const{ return data_[idx]; }
+private:
+        const T* data_;
+        size_t size_;
+};
+
+/*
+        Reader for a ColumnarWriter file. Open only checks the header, a
+        column's pages are read when it is first scanned
+ */
+class ColumnarFile{
+public:
+        using ResultType = boost::variant<
+               std::shared_ptr<ColumnarFile>,
+               std::string
+        >;
+        static ResultType Open(std::string const& path){
+                using namespace columnar_detail;
+                auto mret = MappedFile::Open(path);
+                if( auto ptr = boost::get<std::string>(&mret) )
+                        return *ptr;
+                auto mapping = boost::get<std::shared_ptr<MappedFile> >(mret);
+                auto view = mapping->View();
+                if( view.size() < sizeof(Header) )
+                        return path + " is too small for a columnar header";
+                auto header = view.Read<Header>(0);
+                if( std::memcmp(header.magic, Magic(), sizeof(header.magic)) != 0 )
+                        return path + " is not a columnar export";
+                if( header.version != Version )
+                        return path + " has unsupported version " + std::to_string(header.version);
+                for(auto const& _ : header.columns){
+                        if( _.size == 0 || _.offset % 8 != 0 || _.offset > view.size() ||
+                            _.count > ( view.size() - _.offset ) / _.size )
+                                return path + " has a column out of range";
+                }
+                auto count = [&](Column id){ return header.columns[static_cast<size_t>(id)].count; };
+                auto strings = header.columns[static_cast<size_t>(Column::Strings)];
+                if( strings.count == 0 || view.data()[strings.offset + strings.count - 1] != '\0' )
+                        return path + " has an unterminated string blob";
+                if( count(Column::FilePath) != count(Column::FileHeader) ||
+                    count(Column::SectionHeader) != count(Column::SectionName) ||
+                    count(Column::SectionHeader) != count(Column::SectionFile) )
+                        return path + " has columns of different lengths";
+                for(auto id : { Column::SymbolValue, Column::SymbolSize, Column::SymbolInfo,
+                                Column::SymbolShndx, Column::SymbolTable, Column::SymbolFile }){
+                        if( count(id) != count(Column::SymbolName) )
+                                return path + " has columns of different lengths";
+                }
+                std::shared_ptr<ColumnarFile> result{new ColumnarFile{mapping, header}};
+                return result;
+        }
+
+        // throws when T is not the element type of the column
+        template<class T>
+        ColumnView<T> Get(Column id)const{
+                auto const& array = header_.columns[static_cast<size_t>(id)];
+                if( array.size != sizeof(T) )
+                        throw std::domain_error("column element size mismatch");
+                return ColumnView<T>{reinterpret_cast<const T*>(mapping_->View().data() + array.offset),
+                                     static_cast<size_t>(array.count)};
+        }
+
+        // offsets are taken from the name columns, so they are not
+        // checked beyond the blob bounds
+        boost::string_view String(std::uint32_t offset)const{
+                auto strings = Get<char>(Column::Strings);
+                if( offset >= strings.size() )
+                        throw std::domain_error("out of range");
+                return boost::string_view{strings.data() + offset};
+        }
+
+        size_t Files()const{ return Count(Column::FilePath); }
+        size_t Sections()const{ return Count(Column::SectionHeader); }
+        size_t Symbols()const{ return Count(Column::SymbolName); }
+private:
+        ColumnarFile(std::shared_ptr<MappedFile> mapping, columnar_detail::Header const& header)
+                :mapping_{std::move(mapping)}, header_(header)
+        {}
+        size_t Count(Column id)const{
+                return static_cast<size_t>(header_.columns[static_cast<size_t>(id)].count);
+        }
+
+        std::shared_ptr<MappedFile> mapping_;
+        columnar_detail::Header header_;
+};
+
+} // end namespace celf
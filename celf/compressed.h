@@ -0,0 +1,240 @@
+#pragma once
+
+#include "celf/elf_file.h"
+#include "celf/thread_pool.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <boost/variant.hpp>
+#ifndef CELF_NO_ZLIB
+#include <zlib.h>
+#endif
+
+namespace celf{
+
+namespace compress_detail{
+
+/*
+        Decompressor over the payload of one section, Read hands out the
+        next bytes into a buffer of the caller's
+ */
+struct Stream{
+        using ResultType = boost::variant<
+                size_t,
+                std::string
+        >;
+        virtual ~Stream()=default;
+        // up to size bytes into buffer, 0 once the payload has ended
+        virtual ResultType Read(char* buffer, size_t size)=0;
+};
+
+#ifndef CELF_NO_ZLIB
+struct ZlibStream : Stream{
+        explicit ZlibStream(MemoryView input):input_{input}{
+                std::memset(&z_, 0, sizeof(z_));
+                ok_ = ::inflateInit(&z_) == Z_OK;
+        }
+        ~ZlibStream(){
+                if( ok_ )
+                        ::inflateEnd(&z_);
+        }
+        ResultType Read(char* buffer, size_t size)override{
+                if( ! ok_ )
+                        return std::string{"Unable to initialise zlib"};
+                // zlib counts in uInt
+                size_t const max_piece = size_t{1} << 30;
+                size_t written = 0;
+                while( written != size && ! done_ ){
+                        if( z_.avail_in == 0 && consumed_ != input_.size() ){
+                                auto n = std::min(input_.size() - consumed_, max_piece);
+                                z_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input_.data() + consumed_));
+                                z_.avail_in = static_cast<uInt>(n);
+                                consumed_ += n;
+                        }
+                        auto out = std::min(size - written, max_piece);
+                        z_.next_out = reinterpret_cast<Bytef*>(buffer + written);
+                        z_.avail_out = static_cast<uInt>(out);
+                        auto ret = ::inflate(&z_, Z_NO_FLUSH);
+                        written += out - z_.avail_out;
+                        if( ret == Z_STREAM_END ){
+                                done_ = true;
+                                break;
+                        }
+                        if( ret == Z_BUF_ERROR && z_.avail_in == 0 && consumed_ == input_.size() )
+                                return std::string{"Truncated zlib stream"};
+                        if( ret != Z_OK )
+                                return std::string{"Corrupt zlib stream: "} + ( z_.msg ? z_.msg : "unknown error" );
+                }
+                return written;
+        }
+private:
+        MemoryView input_;
+        size_t consumed_{0};
+        z_stream z_;
+        bool ok_{false};
+        bool done_{false};
+};
+#endif
+
+// a Stream over the payload of compressed section i, null and error
+// set when the format isn't supported
+inline std::unique_ptr<Stream> Open(ElfFile const& elf, size_t i, Elf64_Chdr const& chdr, std::string& error){
+        switch(chdr.ch_type){
+#ifndef CELF_NO_ZLIB
+        case ELFCOMPRESS_ZLIB:{
+                auto sh = elf.section_headers[i];
+                return std::make_unique<ZlibStream>(elf.memory.Slice(sh.sh_offset + sizeof(Elf64_Chdr),
+                                                                     sh.sh_size - sizeof(Elf64_Chdr)));
+        }
+#endif
+        default:
+                error = "Unsupported compression " + ElfCompressionType(chdr.ch_type).TaggedName();
+                return nullptr;
+        }
+}
+
+} // end namespace compress_detail
+
+/*
+        Calls f(MemoryView) with the contents of section i, at most
+        chunk_size bytes at a time. A SHF_COMPRESSED section is inflated
+        as it goes into one buffer of chunk_size, so however big it is
+        nothing larger is held. Returns an error, empty once the whole
+        section has been handed out
+ */
+template<class F>
+std::string StreamSection(ElfFile const& elf, size_t i, size_t chunk_size, F const& f){
+        auto sh = elf.section_headers.at(i);
+        if( sh.sh_type == SHT_NOBITS )
+                return std::string{};
+        if( ! elf.memory.Contains(sh.sh_offset, sh.sh_size) )
+                return "Section " + std::to_string(i) + " out of range";
+        chunk_size = std::max<size_t>(chunk_size, 1);
+        if( ! ( sh.sh_flags & SHF_COMPRESSED ) ){
+                auto mem = elf.memory.Slice(sh.sh_offset, sh.sh_size);
+                for(size_t offset=0;offset < mem.size();offset += chunk_size)
+                        f(mem.Slice(offset, std::min(chunk_size, mem.size() - offset)));
+                return std::string{};
+        }
+        auto chdr = elf.CompressionHeader(i);
+        if( ! chdr )
+                return "Section " + std::to_string(i) + " too small for a compression header";
+        std::string error;
+        auto stream = compress_detail::Open(elf, i, *chdr, error);
+        if( ! stream )
+                return error;
+        std::vector<char> buffer(std::min<Elf64_Xword>(chunk_size, std::max<Elf64_Xword>(chdr->ch_size, 1)));
+        Elf64_Xword total = 0;
+        for(;;){
+                auto ret = stream->Read(buffer.data(), buffer.size());
+                if( auto ptr = boost::get<std::string>(&ret) )
+                        return *ptr;
+                auto n = boost::get<size_t>(ret);
+                if( n == 0 )
+                        break;
+                total += n;
+                if( total > chdr->ch_size )
+                        break;
+                f(MemoryView{buffer.data(), n});
+        }
+        if( total != chdr->ch_size )
+                return "Section " + std::to_string(i) + " doesn't inflate to ch_size";
+        return std::string{};
+}
+
+/*
+        The inflated contents of the SHF_COMPRESSED sections of a file.
+        Each is decompressed the first time it's asked for and kept, and
+        different sections can be decompressed at the same time, which
+        DecompressAll does over a pool. For sections too big to hold
+        twice, StreamSection hands the bytes out in chunks instead
+ */
+class DecompressedSections{
+public:
+        using ResultType = boost::variant<
+                MemoryView,
+                std::string
+        >;
+
+        explicit DecompressedSections(ElfFile const& elf)
+                :elf_{&elf}, entries_{new Entry[elf.section_headers.size()]}
+        {}
+
+        // contents of section i, inflated when it's compressed
+        ResultType Get(size_t i)const{
+                auto sh = elf_->section_headers.at(i);
+                if( ! ( sh.sh_flags & SHF_COMPRESSED ) ){
+                        if( sh.sh_type == SHT_NOBITS )
+                                return MemoryView{};
+                        if( ! elf_->memory.Contains(sh.sh_offset, sh.sh_size) )
+                                return "Section " + std::to_string(i) + " out of range";
+                        return elf_->memory.Slice(sh.sh_offset, sh.sh_size);
+                }
+                auto& e = entries_[i];
+                std::call_once(e.once, [&](){
+                        e.error = Decompress(i, e.data);
+                });
+                if( ! e.error.empty() )
+                        return e.error;
+                return MemoryView{e.data.data(), e.data.size()};
+        }
+        // decompresses every compressed section not done yet, in
+        // parallel when there is a pool
+        void DecompressAll(ThreadPool* pool)const{
+                TaskGroup group{pool};
+                for(size_t i=0;i!=elf_->section_headers.size();++i){
+                        if( elf_->CompressionHeader(i) )
+                                group.Run([this, i](){ Get(i); });
+                }
+                group.Wait();
+        }
+private:
+        struct Entry{
+                std::once_flag once;
+                std::vector<char> data;
+                std::string error;
+        };
+
+        std::string Decompress(size_t i, std::vector<char>& data)const{
+                auto chdr = elf_->CompressionHeader(i);
+                if( ! chdr )
+                        return "Section " + std::to_string(i) + " too small for a compression header";
+                std::string error;
+                auto stream = compress_detail::Open(*elf_, i, *chdr, error);
+                if( ! stream )
+                        return error;
+                try{
+                        data.resize(chdr->ch_size);
+                } catch(std::exception const&){
+                        return "Section " + std::to_string(i) + " is too big to inflate, ch_size " +
+                               std::to_string(chdr->ch_size);
+                }
+                auto ret = stream->Read(data.data(), data.size());
+                if( auto ptr = boost::get<std::string>(&ret) )
+                        return *ptr;
+                // anything past ch_size is as wrong as stopping short
+                char extra;
+                auto rest = stream->Read(&extra, 1);
+                if( boost::get<size_t>(ret) != data.size() || boost::get<size_t>(&rest) == nullptr ||
+                    boost::get<size_t>(rest) != 0 ){
+                        data.clear();
+                        return "Section " + std::to_string(i) + " doesn't inflate to ch_size";
+                }
+                return std::string{};
+        }
+
+        ElfFile const* elf_;
+        std::unique_ptr<Entry[]> entries_;
+};
+
+inline DecompressedSections const& ElfFile::Decompressed()const{
+        std::call_once(decompressed_once_, [this](){
+                decompressed_ = std::make_shared<DecompressedSections>(*this);
+        });
+        return *decompressed_;
+}
+
+} // end namespace celf
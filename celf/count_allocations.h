@@ -0,0 +1,77 @@
+#pragma once
+
+/*
+        Replaces the global operator new and delete so that Stats can count
+        heap allocations. Include it in exactly one translation unit of a
+        program
+ */
+#include "celf/stats.h"
+
+#include <cstdlib>
+#include <new>
+
+#ifndef CELF_NO_STATS
+
+namespace celf{
+namespace allocations_detail{
+
+// malloc retried through the new handler, null when there is none left
+inline void* Allocate(size_t size){
+        auto& counters = Allocations();
+        if( counters.enabled.load(std::memory_order_relaxed) ){
+                counters.count.fetch_add(1, std::memory_order_relaxed);
+                counters.bytes.fetch_add(size, std::memory_order_relaxed);
+        }
+        for(;;){
+                if( void* ptr = std::malloc(size ? size : 1) )
+                        return ptr;
+                auto handler = std::get_new_handler();
+                if( ! handler )
+                        return nullptr;
+                handler();
+        }
+}
+
+} // end namespace allocations_detail
+} // end namespace celf
+
+void* operator new(size_t size){
+        if( void* ptr = celf::allocations_detail::Allocate(size) )
+                return ptr;
+        throw std::bad_alloc{};
+}
+void* operator new[](size_t size){
+        return operator new(size);
+}
+// every form is replaced, a sanitizer or the library would otherwise
+// free memory of a different allocator
+void* operator new(size_t size, std::nothrow_t const&)noexcept{
+        try{
+                return celf::allocations_detail::Allocate(size);
+        } catch(...){
+                return nullptr;
+        }
+}
+void* operator new[](size_t size, std::nothrow_t const&)noexcept{
+        return operator new(size, std::nothrow);
+}
+void operator delete(void* ptr)noexcept{
+        std::free(ptr);
+}
+void operator delete(void* ptr, size_t)noexcept{
+        std::free(ptr);
+}
+void operator delete[](void* ptr)noexcept{
+        std::free(ptr);
+}
+void operator delete[](void* ptr, size_t)noexcept{
+        std::free(ptr);
+}
+void operator delete(void* ptr, std::nothrow_t const&)noexcept{
+        std::free(ptr);
+}
+void operator delete[](void* ptr, std::nothrow_t const&)noexcept{
+        std::free(ptr);
+}
+
+#endif
@@ -0,0 +1,284 @@
+#pragma once
+
+#include "celf/elf_file.h"
+#include "celf/json.h"
+#include "celf/thread_pool.h"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <boost/utility/string_view.hpp>
+
+namespace celf{
+
+struct DiffSummary{
+        size_t added{0};
+        size_t removed{0};
+        size_t changed{0};
+
+        bool empty()const{ return added == 0 && removed == 0 && changed == 0; }
+};
+
+namespace diff_detail{
+
+/*
+        Sort key of a section, symbol or segment. Names that repeat, such
+        as local symbols from different objects, are told apart by their
+        ordinal among the entries with the same group and name, in file
+        order
+ */
+struct Key{
+        Elf64_Word group;
+        boost::string_view name;
+        Elf64_Word ordinal;
+        // index in the section, symbol or program header table
+        size_t index;
+};
+
+inline bool operator<(Key const& l, Key const& r){
+        if( l.group != r.group )
+                return l.group < r.group;
+        int cmp = l.name.compare(r.name);
+        if( cmp != 0 )
+                return cmp < 0;
+        return l.ordinal < r.ordinal;
+}
+
+// sorts by group, name and index, then numbers the duplicates
+inline void SortKeys(std::vector<Key>& keys){
+        std::sort(keys.begin(), keys.end(), [](Key const& l, Key const& r){
+                if( l.group != r.group )
+                        return l.group < r.group;
+                int cmp = l.name.compare(r.name);
+                if( cmp != 0 )
+                        return cmp < 0;
+                return l.index < r.index;
+        });
+        for(size_t i=1;i<keys.size();++i){
+                auto const& prev = keys[i-1];
+                if( prev.group == keys[i].group && prev.name == keys[i].name )
+                        keys[i].ordinal = prev.ordinal + 1;
+        }
+}
+
+// calls removed(l), added(r) or both(l, r) in key order
+template<class Both, class Removed, class Added>
+void MergeJoin(std::vector<Key> const& left, std::vector<Key> const& right,
+               Both const& both, Removed const& removed, Added const& added){
+        auto l = left.begin();
+        auto r = right.begin();
+        while( l != left.end() || r != right.end() ){
+                if( r == right.end() || ( l != left.end() && *l < *r ) ){
+                        removed(*l++);
+                } else if( l == left.end() || *r < *l ){
+                        added(*r++);
+                } else {
+                        both(*l++, *r++);
+                }
+        }
+}
+
+inline boost::string_view NameOr(ElfFile const& elf, Elf64_Word index, Elf64_Word offset){
+        try{
+                return elf.LookupName(index, offset);
+        } catch(std::exception const&){
+                return boost::string_view{};
+        }
+}
+
+inline std::vector<Key> SectionKeys(ElfFile const& elf){
+        std::vector<Key> keys;
+        for(size_t i=0;i!=elf.section_headers.size();++i){
+                if( elf.filter && ! elf.filter->ShowSection(i) )
+                        continue;
+                auto const& sh = elf.section_headers[i];
+                keys.push_back(Key{0, NameOr(elf, elf.NameSectionIndex(), sh.sh_name), 0, i});
+        }
+        SortKeys(keys);
+        return keys;
+}
+
+// unnamed symbols can't be matched up and are left out
+inline std::vector<Key> SymbolKeys(ElfFile const& elf){
+        std::vector<Key> keys;
+        for(size_t i=0;i!=elf.sections.size();++i){
+                auto symt = boost::get<SymbolTable>(&elf.sections[i]);
+                if( ! symt || ( elf.filter && ! elf.filter->ShowSection(i) ) )
+                        continue;
+                // symbols are keyed by table kind, not section index,
+                // which moves when sections are added
+                Elf64_Word group = symt->IsDynamic() ? SHT_DYNSYM : SHT_SYMTAB;
+                keys.reserve(keys.size() + symt->size());
+                for(size_t idx=1;idx<symt->size();++idx){
+                        auto sym = (*symt)[idx];
+                        if( sym.st_name == 0 )
+                                continue;
+                        if( elf.filter && ! elf.filter->ShowSymbol(elf, *symt, sym) )
+                                continue;
+                        auto name = NameOr(elf, symt->Link(), sym.st_name);
+                        if( name.empty() )
+                                continue;
+                        keys.push_back(Key{group, name, 0, i << 32 | idx});
+                }
+        }
+        SortKeys(keys);
+        return keys;
+}
+
+inline std::vector<Key> SegmentKeys(ElfFile const& elf){
+        std::vector<Key> keys;
+        if( elf.filter && ! elf.filter->ProgramHeaders() )
+                return keys;
+        for(size_t i=0;i!=elf.program_headers.size();++i)
+                keys.push_back(Key{elf.program_headers[i].p_type, boost::string_view{}, 0, i});
+        SortKeys(keys);
+        return keys;
+}
+
+inline const char* TableName(Elf64_Word group){
+        return group == SHT_DYNSYM ? "dynsym" : "symtab";
+}
+
+} // end namespace diff_detail
+
+/*
+        What changed from old to new. Sections are matched by name,
+        symbols by table kind and name, and segments by type and position
+        among the segments of that type. Each side is sorted once and the
+        two are merge joined, so the cost is a sort plus a linear pass and
+        nothing is kept beyond the keys. Records are only written for
+        entries that were added, removed or changed, followed by a summary
+ */
+inline DiffSummary DisplayDiff(ElfFile const& old_elf, ElfFile const& new_elf, JsonWriter& out,
+                               ThreadPool* pool = nullptr){
+        using namespace diff_detail;
+        DiffSummary summary;
+
+        std::vector<Key> keys[6];
+        {
+                TaskGroup group{pool};
+                ElfFile const* files[2] = { &old_elf, &new_elf };
+                for(size_t side=0;side!=2;++side){
+                        auto const& elf = *files[side];
+                        group.Run([&keys, &elf, side](){ keys[side] = SectionKeys(elf); });
+                        group.Run([&keys, &elf, side](){ keys[2 + side] = SymbolKeys(elf); });
+                        group.Run([&keys, &elf, side](){ keys[4 + side] = SegmentKeys(elf); });
+                }
+                group.Wait();
+        }
+
+        auto begin = [&](const char* record, const char* change, boost::string_view name){
+                out.BeginRecord(record);
+                out.Field("change", change);
+                out.Field("name", name);
+        };
+        auto end = [&](const char* change){
+                out.EndRecord();
+                if( change[0] == 'a' )
+                        ++summary.added;
+                else if( change[0] == 'r' )
+                        ++summary.removed;
+                else
+                        ++summary.changed;
+        };
+
+        out.BeginDocument();
+
+        auto section_fields = [&](const char* prefix, Elf64_Shdr const& sh, size_t index){
+                std::string p = prefix;
+                out.Field(p + "index", index);
+                out.Field(p + "type", ElfSectionType(sh.sh_type).Name());
+                out.Field(p + "addr", sh.sh_addr);
+                out.Field(p + "size", sh.sh_size);
+        };
+        auto section = [&](const char* change, Key const* lk, Key const* rk){
+                begin("section", change, lk ? lk->name : rk->name);
+                if( lk )
+                        section_fields("old_", old_elf.section_headers[lk->index], lk->index);
+                if( rk )
+                        section_fields("new_", new_elf.section_headers[rk->index], rk->index);
+                end(change);
+        };
+        MergeJoin(keys[0], keys[1],
+                [&](Key const& l, Key const& r){
+                        auto const& lsh = old_elf.section_headers[l.index];
+                        auto const& rsh = new_elf.section_headers[r.index];
+                        if( lsh.sh_type != rsh.sh_type || lsh.sh_flags != rsh.sh_flags ||
+                            lsh.sh_addr != rsh.sh_addr || lsh.sh_size != rsh.sh_size )
+                                section("changed", &l, &r);
+                },
+                [&](Key const& l){ section("removed", &l, nullptr); },
+                [&](Key const& r){ section("added", nullptr, &r); });
+
+        auto symbol_at = [](ElfFile const& elf, Key const& key){
+                return boost::get<SymbolTable>(elf.sections[key.index >> 32])[key.index & 0xffffffff];
+        };
+        auto symbol = [&](const char* change, Key const* lk, Key const* rk){
+                auto const& any = lk ? *lk : *rk;
+                begin("symbol", change, any.name);
+                out.Field("table", TableName(any.group));
+                if( lk ){
+                        auto sym = symbol_at(old_elf, *lk);
+                        out.Field("old_value", sym.st_value);
+                        out.Field("old_size", sym.st_size);
+                        out.Field("old_info", (int)sym.st_info);
+                }
+                if( rk ){
+                        auto sym = symbol_at(new_elf, *rk);
+                        out.Field("new_value", sym.st_value);
+                        out.Field("new_size", sym.st_size);
+                        out.Field("new_info", (int)sym.st_info);
+                }
+                end(change);
+        };
+        MergeJoin(keys[2], keys[3],
+                [&](Key const& l, Key const& r){
+                        auto ls = symbol_at(old_elf, l);
+                        auto rs = symbol_at(new_elf, r);
+                        if( ls.st_value != rs.st_value || ls.st_size != rs.st_size || ls.st_info != rs.st_info )
+                                symbol("changed", &l, &r);
+                },
+                [&](Key const& l){ symbol("removed", &l, nullptr); },
+                [&](Key const& r){ symbol("added", nullptr, &r); });
+
+        auto segment_fields = [&](const char* prefix, Elf64_Phdr const& ph){
+                MaskBuffer flags;
+                std::string p = prefix;
+                out.Field(p + "flags", ElfSegmentAttributes.MaskToString(ph.p_flags, flags));
+                out.Field(p + "vaddr", ph.p_vaddr);
+                out.Field(p + "filesz", ph.p_filesz);
+                out.Field(p + "memsz", ph.p_memsz);
+        };
+        auto segment = [&](const char* change, Key const* lk, Key const* rk){
+                auto const& any = lk ? *lk : *rk;
+                out.BeginRecord("segment");
+                out.Field("change", change);
+                out.Field("p_type", ElfSegmentType(any.group).Name());
+                out.Field("ordinal", any.ordinal);
+                if( lk )
+                        segment_fields("old_", old_elf.program_headers[lk->index]);
+                if( rk )
+                        segment_fields("new_", new_elf.program_headers[rk->index]);
+                end(change);
+        };
+        MergeJoin(keys[4], keys[5],
+                [&](Key const& l, Key const& r){
+                        auto const& lph = old_elf.program_headers[l.index];
+                        auto const& rph = new_elf.program_headers[r.index];
+                        if( lph.p_flags != rph.p_flags || lph.p_vaddr != rph.p_vaddr ||
+                            lph.p_filesz != rph.p_filesz || lph.p_memsz != rph.p_memsz )
+                                segment("changed", &l, &r);
+                },
+                [&](Key const& l){ segment("removed", &l, nullptr); },
+                [&](Key const& r){ segment("added", nullptr, &r); });
+
+        out.BeginRecord("summary");
+        out.Field("added", summary.added);
+        out.Field("removed", summary.removed);
+        out.Field("changed", summary.changed);
+        out.EndRecord();
+        out.EndDocument();
+        return summary;
+}
+
+} // end namespace celf
@@ -0,0 +1,607 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+#include <boost/utility/string_view.hpp>
+#include <boost/optional.hpp>
+
+namespace celf{
+
+//                                     Size |Allign| 
+//                                    ------+------+-------------------------
+using Elf64_Addr   = void*;         //  8   |    8 | Unsigned program address
+using Elf64_Off    = std::uint64_t; //  8   |    8 | Unsigned file offset
+using Elf64_Half   = std::uint16_t; //  2   |    2 | Unsigned medium integer
+using Elf64_Word   = std::uint32_t; //  4   |    4 | Unsigned integer
+using Elf64_Sword  = std::int32_t;  //  4   |    4 | Signed integer
+using Elf64_Xword  = std::uint64_t; //  8   |    8 | Unsigned long integer
+using Elf64_Sxword = std::int64_t;  //  8   |    8 | Signed long integer
+
+typedef struct
+{
+	unsigned char e_ident[16]; /* ELF identification */
+	Elf64_Half e_type;         /* Object file type */
+	Elf64_Half e_machine;      /* Machine type */
+	Elf64_Word e_version;      /* Object file version */
+	Elf64_Addr e_entry;        /* Entry point address */
+	Elf64_Off e_phoff;         /* Program header offset */
+	Elf64_Off e_shoff;         /* Section header offset */
+	Elf64_Word e_flags;        /* Processor-specific flags */
+	Elf64_Half e_ehsize;       /* ELF header size */
+	Elf64_Half e_phentsize;    /* Size of program header entry */
+	Elf64_Half e_phnum;        /* Number of program header entries */
+	Elf64_Half e_shentsize;    /* Size of section header entry */
+	Elf64_Half e_shnum;        /* Number of section header entries */
+	Elf64_Half e_shstrndx;     /* Section name string table index */
+} Elf64_Ehdr;
+
+typedef struct
+{
+        Elf64_Word  sh_name;      /* Section name */
+        Elf64_Word  sh_type;      /* Section type */
+        Elf64_Xword sh_flags;     /* Section attributes */
+        Elf64_Addr  sh_addr;      /* Virtual address in memory */
+        Elf64_Off   sh_offset;    /* Offset in file */
+        Elf64_Xword sh_size;      /* Size of section */
+        Elf64_Word  sh_link;      /* Link to other section */
+        Elf64_Word  sh_info;      /* Miscellaneous information */
+        Elf64_Xword sh_addralign; /* Address alignment boundary */
+        Elf64_Xword sh_entsize;   /* Size of entries, if section has table */
+} Elf64_Shdr;
+
+typedef struct
+{
+        Elf64_Word  p_type;   /* Type of segment */
+        Elf64_Word  p_flags;  /* Segment attributes */
+        Elf64_Off   p_offset; /* Offset in file */
+        Elf64_Addr  p_vaddr;  /* Virtual address in memory */
+        Elf64_Addr  p_paddr;  /* Reserved */
+        Elf64_Xword p_filesz; /* Size of segment in file */
+        Elf64_Xword p_memsz;  /* Size of segment in memory */
+        Elf64_Xword p_align;  /* Alignment of segment */
+} Elf64_Phdr;
+
+typedef struct
+{
+        Elf64_Word st_name; /* Symbol name */
+        unsigned char st_info; /* Type and Binding attributes */
+        unsigned char st_other; /* Reserved */
+        Elf64_Half st_shndx; /* Section table index */
+        Elf64_Addr st_value; /* Symbol value */
+        Elf64_Xword st_size; /* Size of object (e.g., common) */
+} Elf64_Sym;
+
+typedef struct
+{
+        Elf64_Addr  r_offset; /* Address of reference */
+        Elf64_Xword r_info;   /* Symbol index and type of relocation */
+} Elf64_Rel;
+
+typedef struct
+{
+        Elf64_Addr   r_offset; /* Address of reference */
+        Elf64_Xword  r_info;   /* Symbol index and type of relocation */
+        Elf64_Sxword r_addend; /* Constant part of expression */
+} Elf64_Rela;
+
+typedef struct
+{
+        Elf64_Sxword d_tag; /* Type of the entry */
+        Elf64_Xword  d_val; /* Integer value or address, d_un */
+} Elf64_Dyn;
+
+typedef struct
+{
+        Elf64_Word  ch_type;      /* Compression algorithm */
+        Elf64_Word  ch_reserved;
+        Elf64_Xword ch_size;      /* Size of the uncompressed data */
+        Elf64_Xword ch_addralign; /* Alignment of the uncompressed data */
+} Elf64_Chdr;
+
+typedef struct
+{
+        Elf64_Word n_namesz; /* Length of the name, including the NUL */
+        Elf64_Word n_descsz; /* Length of the descriptor */
+        Elf64_Word n_type;   /* Type, interpreted relative to the name */
+} Elf64_Nhdr;
+
+inline Elf64_Xword ToXword(Elf64_Addr addr){
+        return static_cast<Elf64_Xword>(reinterpret_cast<std::uintptr_t>(addr));
+}
+inline Elf64_Addr ToAddr(Elf64_Xword x){
+        return reinterpret_cast<Elf64_Addr>(static_cast<std::uintptr_t>(x));
+}
+
+enum ElfIE{
+//          Name           Value | Purpose
+//      ----------------+--------+----------------
+        EI_MAG0=0,     //    0   | File identification
+        EI_MAG1,       //    1   |
+        EI_MAG2,       //    2   |
+        EI_MAG3,       //    3   |
+        EI_CLASS,      //    4   | File class
+        EI_DATA,       //    5   | Data encoding
+        EI_VERSION,    //    6   | File version
+        EI_OSABI,      //    7   | OS/ABI identification
+        EI_ABIVERSION, //    8   | ABI version
+        EI_PAD,        //    9   | Start of padding bytes
+        EI_NIDENT=16,  //   16   | Size of e_ident[]
+};
+
+enum ElfClass{
+//       Name          | Value |     Meaning
+//      ---------------+-------+---------------
+        ELFCLASS32=1, //   1   | 32-bit objects
+        ELFCLASS64,   //   2   | 64-bit objects
+};
+
+enum ElfData{
+        ELFDATA2LSB=1, // 1 Object file data structures are littleendian
+        ELFDATA2MSB,   // 2 Object file data structures are bigendian
+};
+
+
+constexpr size_t ConstLength(const char* s){
+        size_t n = 0;
+        while( s[n] != '\0' )
+                ++n;
+        return n;
+}
+
+template<class T>
+struct Glyph{
+        constexpr Glyph()=default;
+        constexpr Glyph(T value, const char* name, const char* desc = "")
+                :value_{value}, name_{name}, name_size_{ConstLength(name)}, desc_{desc}
+        {}
+        constexpr T Value()const{ return value_; }
+        constexpr boost::string_view Name()const{ return boost::string_view{name_, name_size_}; }
+        constexpr boost::string_view Description()const{ return boost::string_view{desc_, ConstLength(desc_)}; }
+        std::string TaggedName()const{
+                return std::string{name_, name_size_} + "(" + std::to_string(static_cast<long long>(value_)) + ")";
+        }
+private:
+        T value_{};
+        const char* name_{""};
+        size_t name_size_{0};
+        const char* desc_{""};
+};
+
+/*
+        Decoder from an enum value to its name, built entirely at compile
+        time. Values below DenseSize are found with a single table lookup,
+        anything else with a binary search over the sorted values
+ */
+template<class T, size_t N>
+struct EnumSwitch{
+        static constexpr size_t DenseSize = 64;
+        static_assert(N < 255, "glyph index has to fit in a byte");
+
+        constexpr EnumSwitch(Glyph<T> const (&glyphs)[N], const char* default_name)
+                :default_{T{}, default_name}
+        {
+                for(size_t i=0;i!=N;++i){
+                        glyphs_[i] = glyphs[i];
+                        sorted_[i] = static_cast<unsigned char>(i);
+                }
+                // insertion sort, N is small
+                for(size_t i=1;i<N;++i){
+                        for(size_t j=i;j!=0 && Less(sorted_[j], sorted_[j-1]);--j){
+                                auto tmp = sorted_[j];
+                                sorted_[j] = sorted_[j-1];
+                                sorted_[j-1] = tmp;
+                        }
+                }
+                // first glyph wins for duplicated values
+                for(size_t i=N;i!=0;--i){
+                        auto key = Key(glyphs_[i-1].Value());
+                        if( key < DenseSize )
+                                dense_[key] = static_cast<unsigned char>(i);
+                }
+        }
+
+        constexpr Glyph<T> const& Switch(T val)const{
+                auto key = Key(val);
+                if( key < DenseSize ){
+                        if( dense_[key] != 0 )
+                                return glyphs_[dense_[key] - 1];
+                        return default_;
+                }
+                size_t first = 0;
+                size_t last = N;
+                while( first < last ){
+                        size_t mid = first + ( last - first ) / 2;
+                        if( Key(glyphs_[sorted_[mid]].Value()) < key )
+                                first = mid + 1;
+                        else
+                                last = mid;
+                }
+                if( first != N && glyphs_[sorted_[first]].Value() == val )
+                        return glyphs_[sorted_[first]];
+                return default_;
+        }
+        constexpr Glyph<T> const& operator()(T val)const{
+                return this->Switch(val);
+        }
+
+        /*
+                Names of every glyph sharing a bit with mask, joined with
+                '|' in declaration order. Written into buf, which is
+                truncated if it's too small
+         */
+        boost::string_view MaskToString(T mask, char* buf, size_t size)const{
+                size_t used = 0;
+                auto put = [&](boost::string_view s){
+                        auto n = std::min(s.size(), size - used);
+                        std::memcpy(buf + used, s.data(), n);
+                        used += n;
+                };
+                for(auto const& _ : glyphs_ ){
+                        if( !! ( mask & _.Value()) ){
+                                if( used != 0 )
+                                        put("|");
+                                put(_.Name());
+                        }
+                }
+                return boost::string_view{buf, used};
+        }
+        template<size_t M>
+        boost::string_view MaskToString(T mask, char (&buf)[M])const{
+                return MaskToString(mask, buf, M);
+        }
+
+        // value of the glyph called name, the inverse of Switch
+        boost::optional<T> Find(boost::string_view name)const{
+                for(auto const& _ : glyphs_){
+                        if( _.Name() == name )
+                                return _.Value();
+                }
+                return boost::none;
+        }
+private:
+        // compares as unsigned, so signed values can't index the dense table
+        static constexpr std::uint64_t Key(T val){
+                return static_cast<std::uint64_t>(static_cast<std::make_unsigned_t<T> >(val));
+        }
+        constexpr bool Less(size_t l, size_t r)const{
+                return Key(glyphs_[l].Value()) < Key(glyphs_[r].Value());
+        }
+
+        Glyph<T> glyphs_[N];
+        unsigned char sorted_[N]{};
+        // one past the glyph index, 0 for no glyph
+        unsigned char dense_[DenseSize]{};
+        Glyph<T> default_;
+};
+
+template<class T, size_t N>
+constexpr EnumSwitch<T, N> MakeEnumSwitch(Glyph<T> const (&glyphs)[N], const char* default_name = "__unknown__"){
+        return EnumSwitch<T, N>{glyphs, default_name};
+}
+
+// large enough for MaskToString of any of the attribute decoders
+using MaskBuffer = char[128];
+
+static constexpr auto ElfDataClass = MakeEnumSwitch<unsigned char>({
+        {1, "ELFCLASS32", "32-bit objects"},
+        {2, "ELFCLASS64", "64-bit objects"}
+});
+
+static constexpr auto ElfDataEncoding = MakeEnumSwitch<unsigned char>({
+        {1, "ELFDATA2LSB", "Object file data structures are littleendian"},
+        {2, "ELFDATA2MSB", "Object file data structures are bigendian"}
+});
+
+static constexpr auto ElfOSABI = MakeEnumSwitch<unsigned char>({
+        {0, "ELFOSABI_SYSV", "System V ABI"},
+        {1, "ELFOSABI_HPUX", "HP-UX operating system"},
+        {255, "ELFOSABI_HPUX", "ELFOSABI_STANDALONE 255 Standalone (embedded)"}
+});
+
+static constexpr auto ElfObjectType = MakeEnumSwitch<Elf64_Half>({
+        {0,      "ET_NONE",   "No file type"},
+        {1,      "ET_REL",    "Relocatable object file"},
+        {2,      "ET_EXEC",   "Executable file"},
+        {3,      "ET_DYN",    "Shared object file"},
+        {4,      "ET_CORE",   "Core file"},
+        {0xFE00, "ET_LOOS",   "Environment-specific use"},
+        {0xFEFF, "ET_HIOS"},
+        {0xFF00, "ET_LOPROC", "Processor-specific use"},
+        {0xFFFF, "ET_HIPROC"}
+});
+
+enum ElfSHT{
+        SHT_NULL=0,
+        SHT_PROGBITS,
+        SHT_SYMTAB,
+        SHT_STRTAB,
+        SHT_RELA,
+        SHT_HASH,
+        SHT_DYNAMIC,
+        SHT_NOTE,
+        SHT_NOBITS,
+        SHT_REL,
+        SHT_SHLIB,
+        SHT_DYNSYM,
+        SHT_SYMTAB_SHNDX=18,
+        SHT_LOOS=0x60000000,
+        SHT_GNU_HASH=0x6FFFFFF6,
+        SHT_HIOS=0x6FFFFFFF,
+        SHT_LOPROC=0x70000000,
+        SHT_HIPROC=0x7FFFFFFF,
+};
+static constexpr auto ElfSectionType = MakeEnumSwitch<Elf64_Word>({
+        {0, "SHT_NULL", "Marks an unused section header"},
+        {1, "SHT_PROGBITS", "Contains information defined by the program"},
+        {2, "SHT_SYMTAB", "Contains a linker symbol table"},
+        {3, "SHT_STRTAB", "Contains a string table"},
+        {4, "SHT_RELA", "Contains “Rela” type relocation entries"},
+        {5, "SHT_HASH", "Contains a symbol hash table"},
+        {6, "SHT_DYNAMIC", "Contains dynamic linking tables"},
+        {7, "SHT_NOTE", "Contains note information"},
+        {8, "SHT_NOBITS", "Contains uninitialized space; does not occupy any space in the file"},
+        {9, "SHT_REL", "Contains “Rel” type relocation entries"},
+        {10, "SHT_SHLIB", "Reserved"},
+        {11, "SHT_DYNSYM", "Contains a dynamic loader symbol table"},
+        {18, "SHT_SYMTAB_SHNDX", "Contains the section indexes of the symbols whose st_shndx is SHN_XINDEX"},
+        {0x60000000, "SHT_LOOS", "Environment-specific use"},
+        {0x6FFFFFF6, "SHT_GNU_HASH", "Contains a GNU style symbol hash table"},
+        {0x6FFFFFFF, "SHT_HIOS"},
+        {0x70000000, "SHT_LOPROC", "Processor-specific use"},
+        {0x7FFFFFFF, "SHT_HIPROC"}
+});
+
+enum ElfPT{
+        PT_NULL=0,
+        PT_LOAD=1,
+        PT_DYNAMIC=2,
+        PT_INTERP=3,
+        PT_NOTE=4,
+        PT_SHLIB=5,
+        PT_PHDR=6,
+};
+static constexpr auto ElfSegmentType = MakeEnumSwitch<Elf64_Word>({
+        {0, "PT_NULL", "Unused entry"},
+        {1, "PT_LOAD", "Loadable segment"},
+        {2 , "PT_DYNAMIC", "Dynamic linking tables"},
+        {3 , "PT_INTERP", "Program interpreter path name"},
+        {4 , "PT_NOTE", "Note sections"},
+        {5 , "PT_SHLIB", "Reserved"},
+        {6 , "PT_PHDR", "Program header table"},
+        {0x60000000 , "PT_LOOS", "Environment-specific use"},
+        {0x6474e550, "PT_GNU_EH_FRAME", "Exception handling frame header"},
+        {0x6474e551, "PT_GNU_STACK", "Stack permissions"},
+        {0x6474e552, "PT_GNU_RELRO", "Read-only after relocation"},
+        {0x6474e553, "PT_GNU_PROPERTY", "GNU property notes"},
+        {0x6FFFFFFF, "PT_HIOS"},
+        {0x70000000 , "PT_LOPROC", "Processor-specific use"},
+        {0x7FFFFFFF, "PT_HIPROC"}
+});
+
+enum ElfSHF{
+        SHF_WRITE=0x1,
+        SHF_ALLOC=0x2,
+        SHF_EXECINSTR=0x4,
+        // thread local, an SHT_NOBITS one takes no address space
+        SHF_TLS=0x400,
+        // starts with an Elf64_Chdr, the rest is compressed
+        SHF_COMPRESSED=0x800,
+        SHF_MASKOS=0x0F000000,
+        SHF_MASKPROC=0xF0000000,
+};
+static constexpr auto ElfSectionAttributes = MakeEnumSwitch<Elf64_Word>({
+        {0x1, "SHF_WRITE", "Section contains writable data"},
+        {0x2, "SHF_ALLOC", "Section is allocated in memory image of program"},
+        {0x4, "SHF_EXECINSTR", "Section contains executable instructions"},
+        {0x800, "SHF_COMPRESSED", "Section data is compressed, and starts with an Elf64_Chdr"},
+        {0x0F000000, "SHF_MASKOS", "Environment-specific use"},
+        {0xF0000000, "SHF_MASKPROC", "Processor-specific use"}
+});
+
+static constexpr auto ElfSegmentAttributes = MakeEnumSwitch<Elf64_Word>({
+        {0x1, "PF_X", "Execute permission"},
+        {0x2, "PF_W", "Write permission"},
+        {0x4, "PF_R", "Read permission"},
+        {0x00FF0000, "PF_MASKOS", "These flag bits are reserved for environment-specific use"},
+        {0xFF000000, "PF_MASKPROC", "These flag bits are reserv "}
+});
+
+static constexpr auto ElfSymbolBinding = MakeEnumSwitch<char>({
+        {0, "STB_LOCAL", "Not visible outside the object file"},
+        {1, "STB_GLOBAL", "Global symbol, visible to all object files"},
+        {2, "STB_WEAK", "Global scope, but with lower precedence than global symbols"},
+        {10, "STB_LOOS", "Environment-specific use"},
+        {12, "STB_HIOS"},
+        {13, "STB_LOPROC", "Processor-specific use"},
+        {15, "STB_HIPROC"}
+});
+
+
+enum ElfSTB{
+        STB_LOCAL=0,
+        STB_GLOBAL,
+        STB_WEAK,
+        STB_LOOS=10,
+        STB_HIOS=12,
+        STB_LOPROC=13,
+        STB_HIPROC=15,
+};
+
+enum ElfSTT{
+        STT_NOTYPE=0,
+        STT_OBJECT,
+        STT_FUNC,
+        STT_SECTION,
+        STT_FILE,
+        STT_LOOS=10,
+        STT_HIOS=12,
+        STT_LOPROC=13,
+        STT_HIPROC=15,
+};
+
+static constexpr auto ElfSymbolTypes = MakeEnumSwitch<char>({
+        {0, "STT_NOTYPE", "No type specified (e.g., an absolute symbol)"},
+        {1, "STT_OBJECT", "Data object"},
+        {2, "STT_FUNC", "Function entry point"},
+        {3, "STT_SECTION", "Symbol is associated with a section"},
+        {4, "STT_FILE", "Source file associated with the object file"},
+        {10, "STT_LOOS", "Environment-specific use"},
+        {12, "STT_HIOS"},
+        {13, "STT_LOPROC", "Processor-specific use"},
+        {15, "STT_HIPROC"}
+});
+
+static constexpr auto ElfSymbolType = MakeEnumSwitch<Elf64_Word>({
+        {0, "SHN_UNDEF", "Used to mark an undefined or meaningless section reference"},
+        {0xFF00, "SHN_LOPROC", "Processor-specific use"},
+        {0xFF1F, "SHN_HIPROC", ""},
+        {0xFF20, "SHN_LOOS", "Environment-specific use"},
+        {0xFF3F, "SHN_HIOS", ""},
+        {0xFFF1, "SHN_ABS", "Indicates that the corresponding reference is an absolute value"},
+        {0xFFF2, "SHN_COMMON", "Indicates a symbol that has been declared as a common block (Fortran COMMON or C tentative declaration)"},
+        {0xFFFF, "SHN_XINDEX", "The section index is in the SHT_SYMTAB_SHNDX section"}
+});
+       
+enum ElfSHN{ 
+        SHN_UNDEF=0,
+        SHN_LOPROC=0xFF00,
+        SHN_HIPROC=0xFF1F,
+        SHN_LOOS=0xFF20, 
+        SHN_HIOS=0xFF3F, 
+        SHN_ABS=0xFFF1,
+        SHN_COMMON=0xFFF2,
+        SHN_XINDEX=0xFFFF,
+};
+
+enum ElfDT{
+        DT_NULL=0,
+        DT_NEEDED=1,
+        DT_STRTAB=5,
+        DT_SYMTAB=6,
+        DT_SONAME=14,
+        DT_RPATH=15,
+        DT_RUNPATH=29,
+};
+static constexpr auto ElfDynamicTag = MakeEnumSwitch<Elf64_Sxword>({
+        {0, "DT_NULL", "Marks the end of the dynamic array"},
+        {1, "DT_NEEDED", "The string table offset of the name of a needed library"},
+        {2, "DT_PLTRELSZ", "Total size, in bytes, of the relocation entries associated with the procedure linkage table"},
+        {3, "DT_PLTGOT", "Contains an address associated with the linkage table"},
+        {4, "DT_HASH", "Address of the symbol hash table"},
+        {5, "DT_STRTAB", "Address of the dynamic string table"},
+        {6, "DT_SYMTAB", "Address of the dynamic symbol table"},
+        {7, "DT_RELA", "Address of a relocation table with Elf64_Rela entries"},
+        {8, "DT_RELASZ", "Total size, in bytes, of the DT_RELA relocation table"},
+        {9, "DT_RELAENT", "Size, in bytes, of each DT_RELA relocation entry"},
+        {10, "DT_STRSZ", "Total size, in bytes, of the string table"},
+        {11, "DT_SYMENT", "Size, in bytes, of each symbol table entry"},
+        {12, "DT_INIT", "Address of the initialization function"},
+        {13, "DT_FINI", "Address of the termination function"},
+        {14, "DT_SONAME", "The string table offset of the name of this shared object"},
+        {15, "DT_RPATH", "The string table offset of a shared library search path string"},
+        {16, "DT_SYMBOLIC", "Modifies the symbol resolution algorithm for references within the library"},
+        {17, "DT_REL", "Address of a relocation table with Elf64_Rel entries"},
+        {18, "DT_RELSZ", "Total size, in bytes, of the DT_REL relocation table"},
+        {19, "DT_RELENT", "Size, in bytes, of each DT_REL relocation entry"},
+        {20, "DT_PLTREL", "Type of relocation entry used for the procedure linkage table"},
+        {21, "DT_DEBUG", "Reserved for debugger use"},
+        {22, "DT_TEXTREL", "The relocation table contains relocations for a non-writable segment"},
+        {23, "DT_JMPREL", "Address of the relocations associated with the procedure linkage table"},
+        {24, "DT_BIND_NOW", "The dynamic loader should process all relocations before transferring control"},
+        {25, "DT_INIT_ARRAY", "Pointer to an array of pointers to initialization functions"},
+        {26, "DT_FINI_ARRAY", "Pointer to an array of pointers to termination functions"},
+        {27, "DT_INIT_ARRAYSZ", "Size, in bytes, of the array of initialization functions"},
+        {28, "DT_FINI_ARRAYSZ", "Size, in bytes, of the array of termination functions"},
+        {29, "DT_RUNPATH", "The string table offset of a shared library search path string"},
+        {30, "DT_FLAGS", "Flags for the object being loaded"},
+        {32, "DT_PREINIT_ARRAY", "Pointer to an array of pointers to pre-initialization functions"},
+        {33, "DT_PREINIT_ARRAYSZ", "Size, in bytes, of the array of pre-initialization functions"},
+        {34, "DT_SYMTAB_SHNDX", "Address of the SHT_SYMTAB_SHNDX section of the dynamic symbol table"},
+        {35, "DT_RELRSZ", "Total size, in bytes, of the DT_RELR relocation table"},
+        {36, "DT_RELR", "Address of a relocation table with Elf64_Relr entries"},
+        {37, "DT_RELRENT", "Size, in bytes, of each DT_RELR relocation entry"},
+        {0x6000000D, "DT_LOOS", "Environment-specific use"},
+        {0x6FFFF000, "DT_HIOS"},
+        {0x6FFFFEF5, "DT_GNU_HASH", "Address of the GNU style symbol hash table"},
+        {0x6FFFFEF6, "DT_TLSDESC_PLT", "Address of the lazy TLS descriptor resolver PLT entry"},
+        {0x6FFFFEF7, "DT_TLSDESC_GOT", "Address of the GOT entry used by DT_TLSDESC_PLT"},
+        {0x6FFFFFF0, "DT_VERSYM", "Address of the symbol version table"},
+        {0x6FFFFFF9, "DT_RELACOUNT", "Number of relative relocations at the start of DT_RELA"},
+        {0x6FFFFFFA, "DT_RELCOUNT", "Number of relative relocations at the start of DT_REL"},
+        {0x6FFFFFFB, "DT_FLAGS_1", "State flags"},
+        {0x6FFFFFFC, "DT_VERDEF", "Address of the version definition table"},
+        {0x6FFFFFFD, "DT_VERDEFNUM", "Number of version definitions"},
+        {0x6FFFFFFE, "DT_VERNEED", "Address of the version dependency table"},
+        {0x6FFFFFFF, "DT_VERNEEDNUM", "Number of version dependencies"},
+        {0x70000000, "DT_LOPROC", "Processor-specific use"},
+        {0x7FFFFFFF, "DT_HIPROC"}
+});
+
+enum ElfCompress{
+        ELFCOMPRESS_ZLIB=1,
+        ELFCOMPRESS_ZSTD=2,
+};
+static constexpr auto ElfCompressionType = MakeEnumSwitch<Elf64_Word>({
+        {1, "ELFCOMPRESS_ZLIB", "zlib deflate"},
+        {2, "ELFCOMPRESS_ZSTD", "Zstandard"},
+        {0x60000000, "ELFCOMPRESS_LOOS", "Environment-specific use"},
+        {0x6FFFFFFF, "ELFCOMPRESS_HIOS"},
+        {0x70000000, "ELFCOMPRESS_LOPROC", "Processor-specific use"},
+        {0x7FFFFFFF, "ELFCOMPRESS_HIPROC"}
+});
+
+enum ElfEM{
+        EM_X86_64=62,
+};
+
+// r_info types, only meaningful for e_machine EM_X86_64
+static constexpr auto ElfRelocationX86_64 = MakeEnumSwitch<Elf64_Word>({
+        {0, "R_X86_64_NONE"},
+        {1, "R_X86_64_64"},
+        {2, "R_X86_64_PC32"},
+        {3, "R_X86_64_GOT32"},
+        {4, "R_X86_64_PLT32"},
+        {5, "R_X86_64_COPY"},
+        {6, "R_X86_64_GLOB_DAT"},
+        {7, "R_X86_64_JUMP_SLOT"},
+        {8, "R_X86_64_RELATIVE"},
+        {9, "R_X86_64_GOTPCREL"},
+        {10, "R_X86_64_32"},
+        {11, "R_X86_64_32S"},
+        {12, "R_X86_64_16"},
+        {13, "R_X86_64_PC16"},
+        {14, "R_X86_64_8"},
+        {15, "R_X86_64_PC8"},
+        {16, "R_X86_64_DTPMOD64"},
+        {17, "R_X86_64_DTPOFF64"},
+        {18, "R_X86_64_TPOFF64"},
+        {19, "R_X86_64_TLSGD"},
+        {20, "R_X86_64_TLSLD"},
+        {21, "R_X86_64_DTPOFF32"},
+        {22, "R_X86_64_GOTTPOFF"},
+        {23, "R_X86_64_TPOFF32"},
+        {24, "R_X86_64_PC64"},
+        {25, "R_X86_64_GOTOFF64"},
+        {26, "R_X86_64_GOTPC32"},
+        {27, "R_X86_64_GOT64"},
+        {28, "R_X86_64_GOTPCREL64"},
+        {29, "R_X86_64_GOTPC64"},
+        {30, "R_X86_64_GOTPLT64"},
+        {31, "R_X86_64_PLTOFF64"},
+        {32, "R_X86_64_SIZE32"},
+        {33, "R_X86_64_SIZE64"},
+        {34, "R_X86_64_GOTPC32_TLSDESC"},
+        {35, "R_X86_64_TLSDESC_CALL"},
+        {36, "R_X86_64_TLSDESC"},
+        {37, "R_X86_64_IRELATIVE"},
+        {38, "R_X86_64_RELATIVE64"},
+        {41, "R_X86_64_GOTPCRELX"},
+        {42, "R_X86_64_REX_GOTPCRELX"},
+});
+
+} // end namespace celf
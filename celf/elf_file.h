@@ -0,0 +1,911 @@
+#pragma once
+
+#include "celf/elf.h"
+#include "celf/memory.h"
+#include "celf/arena.h"
+#include "celf/thread_pool.h"
+#include "celf/stats.h"
+#include "celf/simd.h"
+#include "celf/filter.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <mutex>
+#include <fstream>
+#include <map>
+#include <boost/variant.hpp>
+#include <boost/utility/string_view.hpp>
+
+namespace celf{
+
+struct Nothing{};
+
+enum class NameMatch{
+        Prefix,
+        Substring,
+};
+
+/*
+        Name offsets matched by StringTable::MatchNames. A name can start
+        part way into an entry, where the linker shares the tail of a
+        longer string, so the result is inclusive ranges of offsets rather
+        than a list of entries
+ */
+struct NameRanges{
+        // sorted and disjoint
+        std::vector<std::pair<Elf64_Word, Elf64_Word> > ranges;
+
+        bool Contains(Elf64_Word offset)const{
+                auto iter = std::upper_bound(ranges.begin(), ranges.end(), offset,
+                                             [](Elf64_Word o, std::pair<Elf64_Word, Elf64_Word> const& r){
+                        return o < r.first;
+                });
+                return iter != ranges.begin() && std::prev(iter)->second >= offset;
+        }
+        bool empty()const{ return ranges.empty(); }
+};
+
+/*
+        Non-owning view of a SHT_STRTAB section. Names are resolved
+        directly from the offset, nothing is split or copied up front
+ */
+struct StringTable{
+        explicit StringTable(MemoryView mem):mem_{mem}{}
+
+        MemoryView Memory()const{ return mem_; }
+
+        boost::string_view At(Elf64_Word offset)const{
+                if( offset >= mem_.size() )
+                        throw std::domain_error("out of range");
+                auto first = mem_.data() + offset;
+                auto last = static_cast<const char*>(std::memchr(first, '\0', mem_.size() - offset));
+                if( last == nullptr )
+                        last = mem_.end();
+                return boost::string_view{first, static_cast<size_t>(last - first)};
+        }
+        boost::string_view operator[](Elf64_Word offset)const{
+                return At(offset);
+        }
+
+        // walks the entries in order, without allocating
+        struct const_iterator{
+                using iterator_category = std::forward_iterator_tag;
+                using value_type        = boost::string_view;
+                using difference_type   = std::ptrdiff_t;
+                using pointer           = boost::string_view const*;
+                using reference         = boost::string_view;
+
+                const_iterator(StringTable const* table, size_t offset):table_{table}, offset_{offset}{}
+                boost::string_view operator*()const{ return table_->At(static_cast<Elf64_Word>(offset_)); }
+                size_t Offset()const{ return offset_; }
+                const_iterator& operator++(){
+                        offset_ += (**this).size() + 1;
+                        if( offset_ > table_->mem_.size() )
+                                offset_ = table_->mem_.size();
+                        return *this;
+                }
+                bool operator==(const_iterator const& that)const{ return offset_ == that.offset_; }
+                bool operator!=(const_iterator const& that)const{ return offset_ != that.offset_; }
+        private:
+                StringTable const* table_;
+                size_t offset_;
+        };
+        const_iterator begin()const{ return const_iterator{this, 0}; }
+        const_iterator end()const{ return const_iterator{this, mem_.size()}; }
+
+        // offset of the first entry starting at or after offset, so the
+        // table can be split into chunks at arbitrary byte offsets
+        size_t EntryStart(size_t offset)const{
+                if( offset == 0 || offset >= mem_.size() )
+                        return std::min(offset, mem_.size());
+                auto ptr = static_cast<const char*>(std::memchr(mem_.data() + offset - 1, '\0', mem_.size() - offset + 1));
+                if( ptr == nullptr )
+                        return mem_.size();
+                return static_cast<size_t>(ptr - mem_.data()) + 1;
+        }
+        // iterator from the first entry starting at or after offset
+        const_iterator IteratorAt(size_t offset)const{
+                return const_iterator{this, EntryStart(offset)};
+        }
+
+        // offset of every entry, only built when a caller asks for it.
+        // With a pool the table is split into chunk_size byte chunks
+        // which are scanned in parallel and joined in order
+        std::vector<Elf64_Word> BuildIndex(ThreadPool* pool = nullptr, size_t chunk_size = 1 << 20)const{
+                chunk_size = std::max<size_t>(chunk_size, 1);
+                // an entry starts at 0 and after every NUL but a trailing one
+                auto scan = [&](size_t first, size_t last, std::vector<Elf64_Word>& out){
+                        if( first == 0 )
+                                out.push_back(0);
+                        simd::EntryStarts(mem_.data(), first == 0 ? 0 : first - 1, last - 1, out);
+                };
+                std::vector<Elf64_Word> index;
+                if( ! pool ){
+                        // straight into the result, a chunk at a time
+                        for(size_t first=0;first < mem_.size();first += chunk_size)
+                                scan(first, std::min(mem_.size(), first + chunk_size), index);
+                        return index;
+                }
+                std::vector<std::vector<Elf64_Word> > parts(
+                        std::max<size_t>(( mem_.size() + chunk_size - 1 ) / chunk_size, 1));
+                ParallelChunks(pool, mem_.size(), chunk_size, [&](size_t first, size_t last){
+                        scan(first, last, parts[first / chunk_size]);
+                });
+                if( parts.size() == 1 ){
+                        index.swap(parts.front());
+                        return index;
+                }
+                size_t total = 0;
+                for(auto const& _ : parts)
+                        total += _.size();
+                index.reserve(total);
+                for(auto const& _ : parts)
+                        index.insert(index.end(), _.begin(), _.end());
+                return index;
+        }
+
+        // offsets of the names that start with, or contain, needle. The
+        // raw table is searched in chunk_size byte chunks, in parallel
+        // with a pool
+        NameRanges MatchNames(boost::string_view needle, NameMatch kind,
+                              ThreadPool* pool = nullptr, size_t chunk_size = 1 << 20)const{
+                using Range = std::pair<Elf64_Word, Elf64_Word>;
+                NameRanges result;
+                if( mem_.empty() || needle.find('\0') != boost::string_view::npos )
+                        return result;
+                if( needle.empty() ){
+                        result.ranges.emplace_back(0, static_cast<Elf64_Word>(mem_.size() - 1));
+                        return result;
+                }
+                chunk_size = std::max<size_t>(chunk_size, 1);
+                std::vector<std::vector<Range> > parts(( mem_.size() + chunk_size - 1 ) / chunk_size);
+                ParallelChunks(pool, mem_.size(), chunk_size, [&](size_t first, size_t last){
+                        auto& part = parts[first / chunk_size];
+                        auto data = mem_.data();
+                        // occurrences starting in the chunk may end past it
+                        auto end = data + std::min(mem_.size(), last + needle.size() - 1);
+                        size_t entry_end = 0;
+                        for(auto ptr = data + first;;++ptr){
+                                ptr = simd::Find(ptr, end, needle.data(), needle.size());
+                                if( ptr == end || static_cast<size_t>(ptr - data) >= last )
+                                        break;
+                                auto pos = static_cast<Elf64_Word>(ptr - data);
+                                if( kind == NameMatch::Prefix ){
+                                        part.emplace_back(pos, pos);
+                                        continue;
+                                }
+                                // every name from the entry start up to the
+                                // last occurrence in the entry contains it
+                                if( ! part.empty() && pos < entry_end ){
+                                        part.back().second = pos;
+                                        continue;
+                                }
+                                auto nul = static_cast<const char*>(::memrchr(data, '\0', pos));
+                                auto start = static_cast<Elf64_Word>(nul ? nul - data + 1 : 0);
+                                auto next = static_cast<const char*>(std::memchr(ptr, '\0', mem_.size() - pos));
+                                entry_end = next ? static_cast<size_t>(next - data) : mem_.size();
+                                part.emplace_back(start, pos);
+                        }
+                });
+                for(auto const& part : parts){
+                        for(auto const& _ : part){
+                                // an entry split between two chunks
+                                if( ! result.ranges.empty() && result.ranges.back().first == _.first )
+                                        result.ranges.back().second = _.second;
+                                else
+                                        result.ranges.push_back(_);
+                        }
+                }
+                return result;
+        }
+private:
+        MemoryView mem_;
+};
+/*
+        One decoded symbol table entry, st_info is split with plain bit
+        operations
+ */
+struct SymbolEntry : Elf64_Sym{
+        SymbolEntry(Elf64_Sym const& sym, size_t index, Elf64_Word shndx)
+                :Elf64_Sym(sym), index_{index}, shndx_{shndx}
+        {}
+
+        size_t Index()const{ return index_; }
+        // st_shndx, or the entry of the SHT_SYMTAB_SHNDX section for
+        // SHN_XINDEX, which files with more than 0xff00 sections use
+        Elf64_Word SectionIndex()const{ return shndx_; }
+        ElfSTB Binding()const{ return static_cast<ElfSTB>(st_info >> 4); }
+        ElfSTT Type()const{ return static_cast<ElfSTT>(st_info & 0xf); }
+        bool IsSpecialSection()const{
+                switch(st_shndx){
+                case SHN_UNDEF:
+                case SHN_LOPROC:
+                case SHN_HIPROC:
+                case SHN_LOOS:
+                case SHN_HIOS:
+                case SHN_ABS:
+                case SHN_COMMON:
+                        return true;
+                }
+                return false;
+        }
+        bool IsDefined()const{ return st_shndx != SHN_UNDEF; }
+private:
+        size_t index_;
+        Elf64_Word shndx_;
+};
+
+/*
+        Zero-copy view of a SHT_SYMTAB or SHT_DYNSYM section, entries are
+        decoded from the file bytes when they are accessed
+ */
+struct SymbolTable{
+        SymbolTable(TableView<Elf64_Sym> const& view, Elf64_Word type, Elf64_Word link)
+                :view_{view}, type_{type}, link_{link}
+        {}
+
+        bool IsDynamic()const{ return type_ == SHT_DYNSYM; }
+        // section index of the associated string table
+        Elf64_Word Link()const{ return link_; }
+        TableView<Elf64_Sym> const& View()const{ return view_; }
+
+        size_t size()const{ return view_.size(); }
+        bool empty()const{ return view_.empty(); }
+        SymbolEntry operator[](size_t idx)const{ return Entry(view_[idx], idx); }
+        SymbolEntry at(size_t idx)const{ return Entry(view_.at(idx), idx); }
+
+        // the SHT_SYMTAB_SHNDX section linked to this table
+        void SetExtendedIndexes(TableView<Elf64_Word> const& view){ shndx_ = view; }
+
+        struct const_iterator{
+                using iterator_category = std::forward_iterator_tag;
+                using value_type        = SymbolEntry;
+                using difference_type   = std::ptrdiff_t;
+                using pointer           = SymbolEntry const*;
+                using reference         = SymbolEntry;
+
+                const_iterator(SymbolTable const* table, size_t idx):table_{table}, idx_{idx}{}
+                SymbolEntry operator*()const{ return (*table_)[idx_]; }
+                const_iterator& operator++(){ ++idx_; return *this; }
+                bool operator==(const_iterator const& that)const{ return idx_ == that.idx_; }
+                bool operator!=(const_iterator const& that)const{ return idx_ != that.idx_; }
+        private:
+                SymbolTable const* table_;
+                size_t idx_;
+        };
+        const_iterator begin()const{ return const_iterator{this, 0}; }
+        const_iterator end()const{ return const_iterator{this, size()}; }
+private:
+        SymbolEntry Entry(Elf64_Sym const& sym, size_t idx)const{
+                Elf64_Word shndx = sym.st_shndx;
+                if( shndx == SHN_XINDEX && idx < shndx_.size() )
+                        shndx = shndx_[idx];
+                return SymbolEntry{sym, idx, shndx};
+        }
+
+        TableView<Elf64_Sym> view_;
+        Elf64_Word type_;
+        Elf64_Word link_;
+        TableView<Elf64_Word> shndx_;
+};
+
+/*
+        One decoded relocation, r_info split into the symbol index and
+        type. Entries of a SHT_REL section have a zero addend
+ */
+struct RelocationEntry{
+        Elf64_Xword r_offset;
+        Elf64_Xword r_info;
+        Elf64_Sxword r_addend;
+
+        Elf64_Word Symbol()const{ return static_cast<Elf64_Word>(r_info >> 32); }
+        Elf64_Word Type()const{ return static_cast<Elf64_Word>(r_info & 0xffffffff); }
+};
+
+/*
+        Zero-copy view of a SHT_RELA or SHT_REL section. Entries are
+        decoded from the file bytes on access, Decode splits r_info for a
+        whole range at once, and the Count functions aggregate in a single
+        pass over the table
+ */
+struct RelocationTable{
+        RelocationTable(MemoryView mem, size_t entsize, Elf64_Word type, Elf64_Word link, Elf64_Word info)
+                :mem_{mem}, entsize_{entsize}, size_{mem.size() / entsize}, type_{type}, link_{link}, info_{info}
+        {}
+
+        bool HasAddends()const{ return type_ == SHT_RELA; }
+        // section index of the symbol table the entries refer to
+        Elf64_Word Link()const{ return link_; }
+        // section index of the section the relocations apply to
+        Elf64_Word Info()const{ return info_; }
+
+        size_t size()const{ return size_; }
+        bool empty()const{ return size_ == 0; }
+        RelocationEntry operator[](size_t idx)const{
+                auto ptr = mem_.data() + idx * entsize_;
+                RelocationEntry result;
+                std::memcpy(&result.r_offset, ptr, sizeof(Elf64_Xword));
+                std::memcpy(&result.r_info, ptr + sizeof(Elf64_Xword), sizeof(Elf64_Xword));
+                result.r_addend = 0;
+                if( HasAddends() )
+                        std::memcpy(&result.r_addend, ptr + 2 * sizeof(Elf64_Xword), sizeof(Elf64_Sxword));
+                return result;
+        }
+        RelocationEntry at(size_t idx)const{
+                if( idx >= size_ )
+                        throw std::domain_error("out of range");
+                return (*this)[idx];
+        }
+
+        // the symbol and type of entries [first, last), written to
+        // symbols and types from index 0
+        void Decode(size_t first, size_t last, Elf64_Word* symbols, Elf64_Word* types)const{
+                auto ptr = mem_.data() + first * entsize_ + sizeof(Elf64_Xword);
+                for(size_t idx=first;idx!=last;++idx, ptr += entsize_){
+                        Elf64_Xword info;
+                        std::memcpy(&info, ptr, sizeof(info));
+                        *symbols++ = static_cast<Elf64_Word>(info >> 32);
+                        *types++ = static_cast<Elf64_Word>(info & 0xffffffff);
+                }
+        }
+        // entries of each type, sorted by type
+        std::vector<std::pair<Elf64_Word, size_t> > CountByType()const{
+                // types are small for every machine, anything bigger
+                // goes through the map
+                constexpr Elf64_Word Dense = 256;
+                size_t dense[Dense] = {};
+                std::map<Elf64_Word, size_t> sparse;
+                ForEachInfo([&](Elf64_Word symbol, Elf64_Word type){
+                        if( type < Dense )
+                                ++dense[type];
+                        else
+                                ++sparse[type];
+                });
+                std::vector<std::pair<Elf64_Word, size_t> > result;
+                for(Elf64_Word type=0;type!=Dense;++type){
+                        if( dense[type] != 0 )
+                                result.emplace_back(type, dense[type]);
+                }
+                result.insert(result.end(), sparse.begin(), sparse.end());
+                return result;
+        }
+        // entries referring to each symbol index of the linked table,
+        // symbol_count wide, references past it are left out
+        std::vector<size_t> CountBySymbol(size_t symbol_count)const{
+                std::vector<size_t> result(symbol_count);
+                ForEachInfo([&](Elf64_Word symbol, Elf64_Word type){
+                        if( symbol < symbol_count )
+                                ++result[symbol];
+                });
+                return result;
+        }
+private:
+        template<class F>
+        void ForEachInfo(F const& f)const{
+                constexpr size_t Batch = 256;
+                Elf64_Word symbols[Batch];
+                Elf64_Word types[Batch];
+                for(size_t first=0;first < size_;first += Batch){
+                        size_t last = std::min(size_, first + Batch);
+                        Decode(first, last, symbols, types);
+                        for(size_t i=0;i!=last-first;++i)
+                                f(symbols[i], types[i]);
+                }
+        }
+
+        MemoryView mem_;
+        size_t entsize_;
+        size_t size_;
+        Elf64_Word type_;
+        Elf64_Word link_;
+        Elf64_Word info_;
+};
+
+/*
+        Zero-copy view of a SHT_DYNAMIC section. The array ends at the
+        first DT_NULL, anything after it is padding
+ */
+struct DynamicTable{
+        DynamicTable(TableView<Elf64_Dyn> const& view, Elf64_Word link):view_{view}, link_{link}{
+                for(; size_ != view_.size() && view_[size_].d_tag != DT_NULL; ++size_);
+        }
+
+        // section index of the string table DT_NEEDED and friends are in
+        Elf64_Word Link()const{ return link_; }
+
+        size_t size()const{ return size_; }
+        bool empty()const{ return size_ == 0; }
+        Elf64_Dyn operator[](size_t idx)const{ return view_[idx]; }
+        Elf64_Dyn at(size_t idx)const{
+                if( idx >= size_ )
+                        throw std::domain_error("out of range");
+                return view_[idx];
+        }
+
+        // d_val of the first entry with tag
+        boost::optional<Elf64_Xword> Find(Elf64_Sxword tag)const{
+                for(size_t idx=0;idx!=size_;++idx){
+                        auto dyn = view_[idx];
+                        if( dyn.d_tag == tag )
+                                return dyn.d_val;
+                }
+                return boost::none;
+        }
+        // d_val of every entry with tag, in order
+        template<class F>
+        void ForEach(Elf64_Sxword tag, F const& f)const{
+                for(size_t idx=0;idx!=size_;++idx){
+                        auto dyn = view_[idx];
+                        if( dyn.d_tag == tag )
+                                f(dyn.d_val);
+                }
+        }
+private:
+        TableView<Elf64_Dyn> view_;
+        Elf64_Word link_;
+        size_t size_{0};
+};
+
+// e_shnum, or the sh_size of section header 0 when e_shnum is 0
+// because the count doesn't fit in it. memory has to hold that header
+inline size_t SectionCount(Elf64_Ehdr const& header, MemoryView memory){
+        if( header.e_shnum != 0 || header.e_shoff == 0 || ! memory.Contains(header.e_shoff, sizeof(Elf64_Shdr)) )
+                return header.e_shnum;
+        return static_cast<size_t>(memory.Read<Elf64_Shdr>(header.e_shoff).sh_size);
+}
+
+struct SymbolIndex;
+class AddressTranslator;
+class DecompressedSections;
+class IndexCache;
+struct FileFilter;
+
+struct ElfFile{
+
+        using SectionType = boost::variant<
+                Nothing,
+                StringTable,
+                SymbolTable,
+                RelocationTable,
+                DynamicTable
+        >;
+
+        ElfFile()=default;
+        // the section table is allocated from arena
+        explicit ElfFile(Arena* arena):sections{ArenaAllocator<SectionType>{arena}}{}
+
+        // keeps whatever memory refers to alive, either a MappedFile or
+        // a buffer read from a stream
+        std::shared_ptr<const void> storage;
+        MemoryView memory;
+        Elf64_Ehdr header;
+        TableView<Elf64_Shdr> section_headers;
+
+        std::vector< SectionType, ArenaAllocator<SectionType> > sections;
+
+        TableView<Elf64_Phdr> program_headers;
+
+        // set by ParseFile, all zero for files parsed from memory
+        FileIdentity identity;
+
+        // what was selected when the parser was given a Filter, null
+        // when everything was parsed
+        std::shared_ptr<const FileFilter> filter;
+
+        // name and address index over every symbol table, built on
+        // first use, see celf/symbol_index.h
+        SymbolIndex const& Symbols(ThreadPool* pool = nullptr)const;
+        // virtual address to segment, section and file offset, built on
+        // first use, see celf/address.h
+        AddressTranslator const& Addresses()const;
+        // contents of SHF_COMPRESSED sections, each inflated on first
+        // use, see celf/compressed.h
+        DecompressedSections const& Decompressed()const;
+
+        // the Elf64_Chdr of section i, none when it isn't compressed
+        boost::optional<Elf64_Chdr> CompressionHeader(size_t i)const{
+                auto sh = section_headers.at(i);
+                if( ! ( sh.sh_flags & SHF_COMPRESSED ) || sh.sh_type == SHT_NOBITS ||
+                    sh.sh_size < sizeof(Elf64_Chdr) || ! memory.Contains(sh.sh_offset, sh.sh_size) )
+                        return boost::none;
+                return memory.Read<Elf64_Chdr>(sh.sh_offset);
+        }
+
+        // e_shstrndx, or the sh_link of section header 0 when it is
+        // SHN_XINDEX
+        Elf64_Word NameSectionIndex()const{
+                if( header.e_shstrndx == SHN_XINDEX && ! section_headers.empty() )
+                        return section_headers[0].sh_link;
+                return header.e_shstrndx;
+        }
+        boost::string_view SectionName(Elf64_Word offset)const{
+                return LookupName( NameSectionIndex(), offset);
+        }
+        boost::string_view LookupName(Elf64_Word index, Elf64_Word offset)const{
+                if( auto ptr = boost::get<StringTable>(&sections.at(index))){
+                        return ptr->At(offset);
+                }
+                throw std::domain_error("out of range");
+        }
+
+private:
+        friend class IndexCache;
+        mutable std::once_flag symbols_once_;
+        // shared_ptr so ElfFile can be destroyed where SymbolIndex is incomplete
+        mutable std::shared_ptr<SymbolIndex> symbols_;
+        mutable std::once_flag addresses_once_;
+        mutable std::shared_ptr<AddressTranslator> addresses_;
+        mutable std::once_flag decompressed_once_;
+        mutable std::shared_ptr<DecompressedSections> decompressed_;
+};
+
+/*
+        A Filter resolved against one file. Sections are selected from
+        the headers before anything is decoded, and each symbol name glob
+        is turned into the string table offsets that can match it, so
+        most symbols are rejected without resolving their name
+ */
+struct FileFilter{
+        // only the header tables have to be there yet
+        FileFilter(ElfFile const& elf, Filter filter):filter_{std::move(filter)}{
+                size_t count = elf.section_headers.size();
+                size_t shstrndx = elf.NameSectionIndex();
+                boost::optional<StringTable> names;
+                if( shstrndx < count ){
+                        auto const& sh = elf.section_headers[shstrndx];
+                        if( sh.sh_type == SHT_STRTAB && elf.memory.Contains(sh.sh_offset, sh.sh_size) )
+                                names = StringTable{elf.memory.Slice(sh.sh_offset, sh.sh_size)};
+                }
+                auto name_of = [&](size_t i){
+                        auto offset = elf.section_headers[i].sh_name;
+                        if( ! names || offset >= names->Memory().size() )
+                                return boost::string_view{};
+                        return names->At(offset);
+                };
+                auto any_glob = [](std::vector<std::string> const& globs, boost::string_view s){
+                        for(auto const& _ : globs){
+                                if( GlobMatch(_, s) )
+                                        return true;
+                        }
+                        return false;
+                };
+
+                // asking for symbols alone means the symbol tables
+                bool symbols_only = filter_.HasSymbolFilter() && ! filter_.HasSectionFilter();
+                shown_.resize(count);
+                needed_.resize(count);
+                for(size_t i=0;i!=count;++i){
+                        auto const& sh = elf.section_headers[i];
+                        bool is_symtab = sh.sh_type == SHT_SYMTAB || sh.sh_type == SHT_DYNSYM;
+                        bool show = filter_.sections;
+                        if( show && symbols_only )
+                                show = is_symtab;
+                        if( show && ! filter_.section_types.empty() )
+                                show = std::find(filter_.section_types.begin(), filter_.section_types.end(),
+                                                 sh.sh_type) != filter_.section_types.end();
+                        if( show && ! filter_.section_names.empty() )
+                                show = any_glob(filter_.section_names, name_of(i));
+                        if( show && ( sh.sh_flags & SHF_ALLOC ) )
+                                show = filter_.OverlapsAddresses(ToXword(sh.sh_addr), sh.sh_size);
+                        shown_[i] = show;
+                        if( ! show )
+                                continue;
+                        needed_[i] = true;
+                        // the names of the symbols
+                        if( is_symtab && sh.sh_link < count )
+                                needed_[sh.sh_link] = true;
+                        // the library names
+                        if( sh.sh_type == SHT_DYNAMIC && sh.sh_link < count )
+                                needed_[sh.sh_link] = true;
+                        // the symbols relocations refer to, and their names
+                        if( ( sh.sh_type == SHT_RELA || sh.sh_type == SHT_REL ) && sh.sh_link < count ){
+                                needed_[sh.sh_link] = true;
+                                auto link = elf.section_headers[sh.sh_link].sh_link;
+                                if( link < count )
+                                        needed_[link] = true;
+                        }
+                }
+                // the names of the sections
+                if( shstrndx < count )
+                        needed_[shstrndx] = true;
+
+                if( ! filter_.symbol_sections.empty() ){
+                        symbol_sections_.resize(count);
+                        for(size_t i=0;i!=count;++i)
+                                symbol_sections_[i] = any_glob(filter_.symbol_sections, name_of(i));
+                }
+        }
+
+        // the offsets each symbol name glob can match, once the string
+        // tables are decoded
+        void ResolveNames(ElfFile const& elf){
+                if( filter_.symbol_names.empty() )
+                        return;
+                std::vector<GlobPlan> plans;
+                for(auto const& _ : filter_.symbol_names)
+                        plans.push_back(PlanGlob(_));
+                for(size_t i=0;i!=elf.sections.size();++i){
+                        auto symt = boost::get<SymbolTable>(&elf.sections[i]);
+                        if( ! shown_[i] || ! symt || names_.count(symt->Link()) )
+                                continue;
+                        auto& patterns = names_[symt->Link()];
+                        auto st = symt->Link() < elf.sections.size()
+                                ? boost::get<StringTable>(&elf.sections[symt->Link()]) : nullptr;
+                        if( ! st )
+                                continue;
+                        for(size_t k=0;k!=plans.size();++k){
+                                auto const& plan = plans[k];
+                                NamePattern pattern;
+                                pattern.glob = filter_.symbol_names[k];
+                                pattern.verify = plan.verify;
+                                pattern.candidates = st->MatchNames(plan.needle,
+                                        plan.prefix ? NameMatch::Prefix : NameMatch::Substring);
+                                patterns.push_back(std::move(pattern));
+                        }
+                }
+        }
+
+        bool Header()const{ return filter_.header; }
+        bool ProgramHeaders()const{ return filter_.program_headers; }
+        // whether section i has to be decoded
+        bool Needed(size_t i)const{ return needed_[i]; }
+        bool ShowSection(size_t i)const{ return shown_[i]; }
+        bool ShowSegment(Elf64_Phdr const& ph)const{
+                return filter_.program_headers && filter_.OverlapsAddresses(ToXword(ph.p_vaddr), ph.p_memsz);
+        }
+        // the cheap tests first, the name is only resolved for patterns
+        // that the offset alone doesn't decide
+        bool ShowSymbol(ElfFile const& elf, SymbolTable const& symt, SymbolEntry const& sym)const{
+                if( ! filter_.symbol_bindings.empty() &&
+                    std::find(filter_.symbol_bindings.begin(), filter_.symbol_bindings.end(),
+                              static_cast<unsigned char>(sym.Binding())) == filter_.symbol_bindings.end() )
+                        return false;
+                if( ! filter_.symbol_types.empty() &&
+                    std::find(filter_.symbol_types.begin(), filter_.symbol_types.end(),
+                              static_cast<unsigned char>(sym.Type())) == filter_.symbol_types.end() )
+                        return false;
+                if( ! symbol_sections_.empty() &&
+                    ( sym.SectionIndex() >= symbol_sections_.size() || ! symbol_sections_[sym.SectionIndex()] ) )
+                        return false;
+                if( ! filter_.ContainsAddress(ToXword(sym.st_value)) )
+                        return false;
+                if( filter_.symbol_names.empty() )
+                        return true;
+                auto iter = names_.find(symt.Link());
+                if( iter == names_.end() )
+                        return false;
+                for(auto const& _ : iter->second){
+                        if( ! _.candidates.Contains(sym.st_name) )
+                                continue;
+                        if( ! _.verify || GlobMatch(_.glob, elf.LookupName(symt.Link(), sym.st_name)) )
+                                return true;
+                }
+                return false;
+        }
+private:
+        struct NamePattern{
+                std::string glob;
+                bool verify;
+                NameRanges candidates;
+        };
+
+        Filter filter_;
+        std::vector<char> shown_;
+        std::vector<char> needed_;
+        // by st_shndx, empty when not filtered on
+        std::vector<char> symbol_sections_;
+        // by string table section
+        std::map<Elf64_Word, std::vector<NamePattern> > names_;
+};
+
+// an ElfFile from ElfParser, which might live in its arena
+using ElfFilePtr = std::unique_ptr<ElfFile, ArenaDelete<ElfFile> >;
+
+/*
+        Result for input that doesn't start with the ELF magic. It's kept
+        apart from the other errors, so a directory walk can skip such
+        files without matching on a message
+ */
+struct NotElf{
+        static const char* Message(){ return "Not an ELF file"; }
+};
+
+// the message of a failed parse or probe, empty when it didn't fail
+struct ErrorMessage : boost::static_visitor<std::string>{
+        std::string operator()(std::string const& error)const{ return error; }
+        std::string operator()(NotElf)const{ return NotElf::Message(); }
+        template<class T>
+        std::string operator()(T const&)const{ return std::string{}; }
+};
+template<class Result>
+std::string ErrorOf(Result const& ret){
+        return boost::apply_visitor(ErrorMessage{}, ret);
+}
+
+struct ElfParser{
+        using ResultType = boost::variant<
+               ElfFilePtr,
+               std::string,
+               NotElf
+        >;
+        // records the parse phases when set
+        Stats* stats{nullptr};
+        // only what it selects is decoded when set
+        Filter const* filter{nullptr};
+        // the file, its mapping, section table and filter state are
+        // allocated here when set, so they go in one Reset. The arena
+        // mustn't be reset before the result and everything sharing its
+        // storage are gone
+        Arena* arena{nullptr};
+
+        ResultType Parse(std::ifstream& is){
+                is.seekg(0, is.end );
+                size_t file_size= is.tellg();
+                auto buffer = std::make_shared<std::vector<char> >(file_size);
+                {
+                        StatsScope scope{stats, "parse.read", file_size};
+                        is.seekg(0, is.beg );
+                        is.read( buffer->data(), buffer->size());
+                }
+                if( is.bad() ){
+                        return "Unable to read full file";
+                }
+                MemoryView memory{buffer->data(), buffer->size()};
+                return Parse(std::move(buffer), memory);
+        }
+        ResultType ParseFile(std::string const& filename, MapAdvice advice = MapAdvice::Normal){
+                MappedFile::ResultType mret;
+                {
+                        StatsScope scope{stats, "parse.map", filename, 0};
+                        mret = MappedFile::Open(filename, advice, arena);
+                }
+                if( std::string* ptr = boost::get<std::string>(&mret))
+                        return *ptr;
+                auto mapping = boost::get<std::shared_ptr<MappedFile> >(mret);
+                auto pret = Parse(mapping, mapping->View());
+                if( auto ptr = boost::get<ElfFilePtr>(&pret)){
+                        (*ptr)->identity = mapping->Identity();
+                        auto const& header = (*ptr)->header;
+                        mapping->Advise(MapAdvice::WillNeed, header.e_shoff,
+                                        (*ptr)->section_headers.Memory().size());
+                        mapping->Advise(MapAdvice::WillNeed, header.e_phoff,
+                                        static_cast<size_t>(header.e_phnum) * header.e_phentsize);
+                }
+                return pret;
+        }
+        ResultType Parse(std::shared_ptr<const void> storage, MemoryView memory){
+                auto result = ArenaNew<ElfFile>(arena, arena);
+                result->storage = std::move(storage);
+                result->memory = memory;
+
+                if( memory.size() < 4 || std::memcmp(memory.data(), "\x7f" "ELF", 4) != 0 )
+                        return NotElf{};
+                if( memory.size() < sizeof(Elf64_Ehdr) )
+                        return "File too small for an ELF header";
+
+                StatsScope scope{stats, "parse", memory.size()};
+                auto& header = result->header;
+                header = memory.Read<Elf64_Ehdr>(0);
+
+                if( header.e_ident[EI_CLASS] != ELFCLASS64 )
+                        return "Only ELFCLASS64 objects are supported";
+
+                if( header.e_shoff != 0 ){
+                        size_t count = SectionCount(header, memory);
+                        if( header.e_shentsize < sizeof(Elf64_Shdr) || count > memory.size() / header.e_shentsize )
+                                return "Section header table out of range";
+                        size_t table_size = count * header.e_shentsize;
+                        StatsScope scope{stats, "parse.section_headers", table_size};
+                        if( ! memory.Contains(header.e_shoff, table_size) )
+                                return "Section header table out of range";
+                        result->section_headers = TableView<Elf64_Shdr>{
+                                memory.Slice(header.e_shoff, table_size),
+                                header.e_shentsize, count };
+
+                        std::shared_ptr<FileFilter> selection;
+                        if( filter && ! filter->IsEmpty() )
+                                selection = std::allocate_shared<FileFilter>(ArenaAllocator<FileFilter>{arena},
+                                                                             *result, *filter);
+
+                        result->sections.reserve(count);
+                        for(size_t idx=0;idx!=count;++idx){
+                                auto sh = result->section_headers[idx];
+                                if( selection && ! selection->Needed(idx) ){
+                                        result->sections.push_back( Nothing{} );
+                                        continue;
+                                }
+                                // only readable once inflated, see Decompressed()
+                                if( sh.sh_flags & SHF_COMPRESSED ){
+                                        result->sections.push_back( Nothing{} );
+                                        continue;
+                                }
+
+                                switch(sh.sh_type){
+                                case SHT_STRTAB:
+                                case SHT_SYMTAB:
+                                case SHT_DYNSYM:
+                                case SHT_RELA:
+                                case SHT_REL:
+                                case SHT_DYNAMIC:
+                                        if( ! memory.Contains(sh.sh_offset, sh.sh_size) )
+                                                return "Section " + std::to_string(idx) + " out of range";
+                                        break;
+                                }
+
+                                switch(sh.sh_type){
+                                case SHT_STRTAB:
+                                        result->sections.push_back( StringTable{memory.Slice(sh.sh_offset, sh.sh_size)} );
+                                        break;
+                                case SHT_SYMTAB:
+                                case SHT_DYNSYM:
+                                        do{
+                                                size_t entsize = sh.sh_entsize;
+                                                if( entsize < sizeof(Elf64_Sym) )
+                                                        entsize = sizeof(Elf64_Sym);
+                                                TableView<Elf64_Sym> view{
+                                                        memory.Slice(sh.sh_offset, sh.sh_size),
+                                                        entsize, sh.sh_size / entsize };
+                                                result->sections.push_back( SymbolTable{view, sh.sh_type, sh.sh_link} );
+                                        }while(0);
+                                        break;
+                                case SHT_RELA:
+                                case SHT_REL:
+                                        do{
+                                                size_t min_entsize = sh.sh_type == SHT_RELA ? sizeof(Elf64_Rela) : sizeof(Elf64_Rel);
+                                                size_t entsize = std::max<size_t>(sh.sh_entsize, min_entsize);
+                                                result->sections.push_back( RelocationTable{
+                                                        memory.Slice(sh.sh_offset, sh.sh_size),
+                                                        entsize, sh.sh_type, sh.sh_link, sh.sh_info} );
+                                        }while(0);
+                                        break;
+                                case SHT_DYNAMIC:
+                                        do{
+                                                size_t entsize = std::max<size_t>(sh.sh_entsize, sizeof(Elf64_Dyn));
+                                                TableView<Elf64_Dyn> view{
+                                                        memory.Slice(sh.sh_offset, sh.sh_size),
+                                                        entsize, sh.sh_size / entsize };
+                                                result->sections.push_back( DynamicTable{view, sh.sh_link} );
+                                        }while(0);
+                                        break;
+                                default:
+                                        result->sections.push_back( Nothing{} );
+                                        break;
+                                }
+
+                        }
+                        for(size_t idx=0;idx!=count;++idx){
+                                auto sh = result->section_headers[idx];
+                                if( sh.sh_type != SHT_SYMTAB_SHNDX || sh.sh_link >= count )
+                                        continue;
+                                auto symt = boost::get<SymbolTable>(&result->sections[sh.sh_link]);
+                                if( ! symt )
+                                        continue;
+                                if( ! memory.Contains(sh.sh_offset, sh.sh_size) )
+                                        return "Section " + std::to_string(idx) + " out of range";
+                                symt->SetExtendedIndexes(TableView<Elf64_Word>{
+                                        memory.Slice(sh.sh_offset, sh.sh_size),
+                                        sizeof(Elf64_Word), sh.sh_size / sizeof(Elf64_Word)});
+                        }
+                        if( selection ){
+                                selection->ResolveNames(*result);
+                                result->filter = std::move(selection);
+                        }
+                }
+
+                if( header.e_phoff != 0 ){
+                        size_t table_size = static_cast<size_t>(header.e_phnum) * header.e_phentsize;
+                        StatsScope scope{stats, "parse.program_headers", table_size};
+                        if( header.e_phentsize < sizeof(Elf64_Phdr) || ! memory.Contains(header.e_phoff, table_size) )
+                                return "Program header table out of range";
+                        result->program_headers = TableView<Elf64_Phdr>{
+                                memory.Slice(header.e_phoff, table_size),
+                                header.e_phentsize, header.e_phnum };
+                }
+
+                return result;
+        }
+};
+
+} // end namespace celf
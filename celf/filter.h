@@ -0,0 +1,155 @@
+#pragma once
+
+#include "celf/elf.h"
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdlib>
+#include <boost/optional.hpp>
+#include <boost/utility/string_view.hpp>
+
+namespace celf{
+
+// shell style pattern, * matches any run of bytes and ? any one byte
+inline bool GlobMatch(boost::string_view pattern, boost::string_view s){
+        size_t p = 0;
+        size_t i = 0;
+        size_t star = boost::string_view::npos;
+        size_t mark = 0;
+        while( i != s.size() ){
+                if( p != pattern.size() && ( pattern[p] == '?' || pattern[p] == s[i] ) ){
+                        ++p;
+                        ++i;
+                } else if( p != pattern.size() && pattern[p] == '*' ){
+                        star = p++;
+                        mark = i;
+                } else if( star != boost::string_view::npos ){
+                        p = star + 1;
+                        i = ++mark;
+                } else {
+                        return false;
+                }
+        }
+        while( p != pattern.size() && pattern[p] == '*' )
+                ++p;
+        return p == pattern.size();
+}
+
+/*
+        How a glob is run against a raw string table. The needle is
+        searched for with StringTable::MatchNames, and when that alone
+        doesn't decide the match, verify is set and the candidates are
+        checked against the whole pattern
+ */
+struct GlobPlan{
+        std::string needle;
+        bool prefix{false};
+        bool verify{true};
+};
+
+inline GlobPlan PlanGlob(boost::string_view pattern){
+        GlobPlan plan;
+        auto wild = pattern.find_first_of("*?");
+        if( wild == boost::string_view::npos ){
+                // needs the length checked as well
+                plan.needle = pattern.to_string();
+                plan.prefix = true;
+                return plan;
+        }
+        if( wild == pattern.size() - 1 && pattern.back() == '*' ){
+                plan.needle = pattern.substr(0, wild).to_string();
+                plan.prefix = true;
+                plan.verify = false;
+                return plan;
+        }
+        if( wild == 0 && pattern.size() >= 2 && pattern.back() == '*' &&
+            pattern.substr(1, pattern.size() - 2).find_first_of("*?") == boost::string_view::npos ){
+                plan.needle = pattern.substr(1, pattern.size() - 2).to_string();
+                plan.verify = false;
+                return plan;
+        }
+        // the longest literal run is the most selective needle
+        size_t best_first = 0;
+        size_t best_size = 0;
+        for(size_t first=0;first < pattern.size();){
+                auto last = pattern.find_first_of("*?", first);
+                if( last == boost::string_view::npos )
+                        last = pattern.size();
+                if( last - first > best_size ){
+                        best_first = first;
+                        best_size = last - first;
+                }
+                first = last + 1;
+        }
+        plan.needle = pattern.substr(best_first, best_size).to_string();
+        plan.prefix = best_first == 0 && best_size != 0;
+        plan.verify = pattern.find_first_not_of('*') != boost::string_view::npos;
+        return plan;
+}
+
+/*
+        Selects what is parsed and displayed. Each list is a set of
+        alternatives, an empty list allows everything, and the lists are
+        combined with and. Given to ElfParser, it is resolved against each
+        file so unselected sections are never decoded and unselected
+        symbols are never named or written
+ */
+struct Filter{
+        bool header{true};
+        bool sections{true};
+        bool program_headers{true};
+
+        // globs on the section name
+        std::vector<std::string> section_names;
+        std::vector<Elf64_Word> section_types;
+
+        // globs on the symbol name
+        std::vector<std::string> symbol_names;
+        std::vector<unsigned char> symbol_bindings;
+        std::vector<unsigned char> symbol_types;
+        // globs on the name of the section a symbol is defined in
+        std::vector<std::string> symbol_sections;
+
+        // [first, last), compared with symbol values and the addresses of
+        // segments and allocated sections
+        boost::optional<std::pair<Elf64_Xword, Elf64_Xword> > addresses;
+
+        bool HasSectionFilter()const{
+                return ! section_names.empty() || ! section_types.empty();
+        }
+        bool HasSymbolFilter()const{
+                return ! symbol_names.empty() || ! symbol_bindings.empty() ||
+                       ! symbol_types.empty() || ! symbol_sections.empty();
+        }
+        bool IsEmpty()const{
+                return header && sections && program_headers &&
+                       ! HasSectionFilter() && ! HasSymbolFilter() && ! addresses;
+        }
+
+        bool ContainsAddress(Elf64_Xword addr)const{
+                return ! addresses || ( addresses->first <= addr && addr < addresses->second );
+        }
+        bool OverlapsAddresses(Elf64_Xword addr, Elf64_Xword size)const{
+                if( ! addresses || size == 0 )
+                        return ContainsAddress(addr);
+                return addr < addresses->second &&
+                       ( addresses->first <= addr || addresses->first - addr < size );
+        }
+};
+
+// the value of a glyph given by name, with or without prefix, or as a number
+template<class T, size_t N>
+boost::optional<T> ParseGlyph(EnumSwitch<T, N> const& sw, boost::string_view prefix, std::string const& text){
+        if( auto ret = sw.Find(text) )
+                return ret;
+        if( auto ret = sw.Find(prefix.to_string() + text) )
+                return ret;
+        char* end = nullptr;
+        auto value = std::strtoull(text.c_str(), &end, 0);
+        if( text.empty() || *end != '\0' )
+                return boost::none;
+        return static_cast<T>(value);
+}
+
+} // end namespace celf
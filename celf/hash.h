@@ -0,0 +1,366 @@
+#pragma once
+
+#include "celf/elf_file.h"
+#include "celf/notes.h"
+#include "celf/json.h"
+#include "celf/thread_pool.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+namespace celf{
+
+namespace hash_detail{
+
+const std::uint64_t Prime1 = 0x9E3779B185EBCA87ull;
+const std::uint64_t Prime2 = 0xC2B2AE3D27D4EB4Full;
+const std::uint64_t Prime3 = 0x165667B19E3779F9ull;
+const std::uint64_t Prime4 = 0x85EBCA77C2B2AE63ull;
+const std::uint64_t Prime5 = 0x27D4EB2F165667C5ull;
+
+inline std::uint64_t Rotl(std::uint64_t x, int r){
+        return ( x << r ) | ( x >> ( 64 - r ) );
+}
+// the format is defined over little endian words
+inline std::uint64_t Load64(const unsigned char* p){
+        std::uint64_t x = 0;
+        for(int i=7;i>=0;--i)
+                x = ( x << 8 ) | p[i];
+        return x;
+}
+inline std::uint32_t Load32(const unsigned char* p){
+        return std::uint32_t(p[0]) | std::uint32_t(p[1]) << 8 | std::uint32_t(p[2]) << 16 | std::uint32_t(p[3]) << 24;
+}
+inline std::uint64_t Round(std::uint64_t acc, std::uint64_t input){
+        acc += input * Prime2;
+        acc = Rotl(acc, 31);
+        return acc * Prime1;
+}
+inline std::uint64_t Merge(std::uint64_t acc, std::uint64_t lane){
+        acc ^= Round(0, lane);
+        return acc * Prime1 + Prime4;
+}
+
+} // end namespace hash_detail
+
+/*
+        XXH64 of size bytes, the same value xxhsum -H1 prints. Not
+        cryptographic, it is there to tell contents apart quickly
+ */
+inline std::uint64_t Xxh64(const void* data, size_t size, std::uint64_t seed = 0){
+        using namespace hash_detail;
+        auto p = static_cast<const unsigned char*>(data);
+        auto end = p + size;
+        std::uint64_t h;
+        if( size >= 32 ){
+                std::uint64_t v1 = seed + Prime1 + Prime2;
+                std::uint64_t v2 = seed + Prime2;
+                std::uint64_t v3 = seed;
+                std::uint64_t v4 = seed - Prime1;
+                for(; end - p >= 32; p += 32){
+                        v1 = Round(v1, Load64(p));
+                        v2 = Round(v2, Load64(p + 8));
+                        v3 = Round(v3, Load64(p + 16));
+                        v4 = Round(v4, Load64(p + 24));
+                }
+                h = Rotl(v1, 1) + Rotl(v2, 7) + Rotl(v3, 12) + Rotl(v4, 18);
+                h = Merge(h, v1);
+                h = Merge(h, v2);
+                h = Merge(h, v3);
+                h = Merge(h, v4);
+        } else {
+                h = seed + Prime5;
+        }
+        h += size;
+        for(; end - p >= 8; p += 8){
+                h ^= Round(0, Load64(p));
+                h = Rotl(h, 27) * Prime1 + Prime4;
+        }
+        if( end - p >= 4 ){
+                h ^= Load32(p) * Prime1;
+                h = Rotl(h, 23) * Prime2 + Prime3;
+                p += 4;
+        }
+        for(; p != end; ++p){
+                h ^= *p * Prime5;
+                h = Rotl(h, 11) * Prime1;
+        }
+        h ^= h >> 33;
+        h *= Prime2;
+        h ^= h >> 29;
+        h *= Prime3;
+        h ^= h >> 32;
+        return h;
+}
+
+// the way xxhsum writes a hash, big endian hex
+inline std::string HashHex(std::uint64_t hash){
+        std::string result(16, '0');
+        for(size_t i=16;i!=0;hash >>= 4)
+                result[--i] = "0123456789abcdef"[hash & 0xf];
+        return result;
+}
+
+/*
+        Hashes of file contents. Anything up to ChunkSize bytes hashes to
+        its plain Xxh64. Longer contents are split into ChunkSize pieces
+        that are hashed on their own, in parallel, and the hash is Xxh64
+        of the little endian piece hashes seeded with the total size. So
+        the value doesn't depend on the number of threads, only on the
+        bytes
+ */
+class ContentHasher{
+public:
+        static const size_t ChunkSize = 1024 * 1024;
+
+        // one hash per view, in order
+        static std::vector<std::uint64_t> Hash(std::vector<MemoryView> const& views, ThreadPool* pool){
+                struct Leaf{
+                        size_t view;
+                        size_t offset;
+                };
+                size_t chunk = ChunkSize;
+                std::vector<size_t> first_leaf;
+                std::vector<Leaf> leaves;
+                first_leaf.reserve(views.size() + 1);
+                for(size_t i=0;i!=views.size();++i){
+                        first_leaf.push_back(leaves.size());
+                        size_t offset = 0;
+                        do{
+                                leaves.push_back(Leaf{i, offset});
+                                offset += chunk;
+                        }while( offset < views[i].size() );
+                }
+                first_leaf.push_back(leaves.size());
+
+                // leaves of all the views go out together, so a few big
+                // sections and many small ones keep every thread busy
+                std::vector<std::uint64_t> leaf_hashes(leaves.size());
+                ParallelChunks(pool, leaves.size(), 16, [&](size_t first, size_t last){
+                        for(size_t k=first;k!=last;++k){
+                                auto const& mem = views[leaves[k].view];
+                                auto size = std::min(chunk, mem.size() - leaves[k].offset);
+                                leaf_hashes[k] = Xxh64(mem.data() + leaves[k].offset, size);
+                        }
+                });
+
+                std::vector<std::uint64_t> result(views.size());
+                std::vector<unsigned char> buffer;
+                for(size_t i=0;i!=views.size();++i){
+                        size_t count = first_leaf[i + 1] - first_leaf[i];
+                        if( count == 1 ){
+                                result[i] = leaf_hashes[first_leaf[i]];
+                                continue;
+                        }
+                        buffer.resize(count * 8);
+                        for(size_t k=0;k!=count;++k){
+                                auto x = leaf_hashes[first_leaf[i] + k];
+                                for(size_t b=0;b!=8;++b)
+                                        buffer[8 * k + b] = static_cast<unsigned char>(x >> ( 8 * b ));
+                        }
+                        result[i] = Xxh64(buffer.data(), buffer.size(), views[i].size());
+                }
+                return result;
+        }
+};
+
+struct ContentHash{
+        // section or program header index
+        Elf64_Word index;
+        Elf64_Off offset;
+        // bytes hashed, none for SHT_NOBITS
+        Elf64_Xword size;
+        std::uint64_t hash;
+        // out of the file, not hashed
+        bool missing;
+        // left out of the fingerprint
+        bool excluded;
+};
+
+/*
+        Hashes of every section and PT_LOAD segment of a file, and a
+        fingerprint of the whole of it that stays the same when only the
+        build id differs. Sections are hashed as they are on disk, a
+        SHF_COMPRESSED one is not inflated first
+ */
+struct ContentHashes{
+        std::vector<ContentHash> sections;
+        std::vector<ContentHash> segments;
+        std::uint64_t fingerprint{0};
+        // bytes that went into the fingerprint
+        std::uint64_t fingerprint_bytes{0};
+};
+
+namespace hash_detail{
+
+/*
+        Sections that change from one build of the same sources to the
+        next. The debuglink holds a CRC of the separate debug file, which
+        has the build id in it
+ */
+inline bool VolatileSection(ElfFile const& elf, size_t i){
+        auto sh = elf.section_headers[i];
+        if( elf.SectionName(sh.sh_name) == ".gnu_debuglink" )
+                return true;
+        std::string build_id;
+        return sh.sh_type == SHT_NOTE && elf.memory.Contains(sh.sh_offset, sh.sh_size) &&
+               FindBuildId(elf.memory.Slice(sh.sh_offset, sh.sh_size), build_id);
+}
+
+// the parts of [first, last) outside the sorted, disjoint holes
+inline void Punch(Elf64_Off first, Elf64_Off last, std::vector<std::pair<Elf64_Off, Elf64_Off> > const& holes,
+                  std::vector<std::pair<Elf64_Off, Elf64_Off> >& result){
+        for(auto const& _ : holes){
+                if( _.second <= first || _.first >= last )
+                        continue;
+                if( _.first > first )
+                        result.emplace_back(first, _.first);
+                first = std::max(first, _.second);
+        }
+        if( first < last )
+                result.emplace_back(first, last);
+}
+
+inline void Append(std::vector<unsigned char>& buffer, std::uint64_t x){
+        for(size_t b=0;b!=8;++b)
+                buffer.push_back(static_cast<unsigned char>(x >> ( 8 * b )));
+}
+
+inline void Append(std::vector<unsigned char>& buffer, MemoryView mem){
+        buffer.insert(buffer.end(), mem.data(), mem.data() + mem.size());
+}
+
+} // end namespace hash_detail
+
+/*
+        Hashes the sections and PT_LOAD segments of elf, all the chunks of
+        all of them in parallel when there is a pool.
+
+        The fingerprint covers the ELF header, the program and section
+        header tables and the hash of every section except the volatile
+        ones. Without section headers it covers the PT_LOAD segments
+        instead, less the descriptors of their build id notes. Bytes in no
+        section, padding mostly, are left out
+ */
+inline ContentHashes HashContents(ElfFile const& elf, ThreadPool* pool = nullptr){
+        using namespace hash_detail;
+        ContentHashes result;
+        std::vector<MemoryView> views;
+        auto add = [&](std::vector<ContentHash>& to, size_t index, Elf64_Off offset, Elf64_Xword size){
+                ContentHash h{static_cast<Elf64_Word>(index), offset, size, 0, false, false};
+                h.missing = ! elf.memory.Contains(offset, size);
+                to.push_back(h);
+                views.push_back(h.missing ? MemoryView{} : elf.memory.Slice(offset, size));
+        };
+        for(size_t i=0;i!=elf.section_headers.size();++i){
+                auto sh = elf.section_headers[i];
+                add(result.sections, i, sh.sh_offset, sh.sh_type == SHT_NOBITS ? 0 : sh.sh_size);
+                result.sections.back().excluded = VolatileSection(elf, i);
+        }
+        for(size_t i=0;i!=elf.program_headers.size();++i){
+                auto ph = elf.program_headers[i];
+                if( ph.p_type == PT_LOAD )
+                        add(result.segments, i, ph.p_offset, ph.p_filesz);
+        }
+
+        // a file stripped of its section headers still has the build id
+        // in its segments, only the rest of them is fingerprinted
+        std::vector<std::pair<Elf64_Off, Elf64_Off> > pieces;
+        if( elf.section_headers.size() == 0 ){
+                std::vector<std::pair<Elf64_Off, Elf64_Off> > holes;
+                for(auto const& ph : elf.program_headers){
+                        if( ph.p_type != PT_NOTE || ! elf.memory.Contains(ph.p_offset, ph.p_filesz) )
+                                continue;
+                        ForEachNote(elf.memory.Slice(ph.p_offset, ph.p_filesz),
+                                    [&](boost::string_view name, Elf64_Word type, MemoryView desc){
+                                if( type == NT_GNU_BUILD_ID && name == "GNU" ){
+                                        Elf64_Off first = desc.data() - elf.memory.data();
+                                        holes.emplace_back(first, first + desc.size());
+                                }
+                        });
+                }
+                std::sort(holes.begin(), holes.end());
+                for(auto const& _ : result.segments){
+                        if( ! _.missing )
+                                Punch(_.offset, _.offset + _.size, holes, pieces);
+                }
+                for(auto const& _ : pieces)
+                        views.push_back(elf.memory.Slice(_.first, _.second - _.first));
+        }
+
+        auto hashes = ContentHasher::Hash(views, pool);
+        size_t k = 0;
+        for(auto& _ : result.sections)
+                _.hash = hashes[k++];
+        for(auto& _ : result.segments)
+                _.hash = hashes[k++];
+
+        std::vector<unsigned char> buffer;
+        auto table = [&](Elf64_Off offset, size_t count, size_t entsize){
+                if( elf.memory.Contains(offset, count * entsize) )
+                        Append(buffer, elf.memory.Slice(offset, count * entsize));
+        };
+        Append(buffer, elf.memory.Slice(0, std::min<size_t>(elf.memory.size(), sizeof(Elf64_Ehdr))));
+        table(elf.header.e_phoff, elf.header.e_phnum, elf.header.e_phentsize);
+        table(elf.header.e_shoff, elf.section_headers.size(), elf.header.e_shentsize);
+        for(auto const& _ : result.sections){
+                if( _.excluded || _.missing )
+                        continue;
+                Append(buffer, _.index);
+                Append(buffer, _.hash);
+                result.fingerprint_bytes += _.size;
+        }
+        for(size_t i=0;i!=pieces.size();++i){
+                Append(buffer, pieces[i].first);
+                Append(buffer, hashes[k++]);
+                result.fingerprint_bytes += pieces[i].second - pieces[i].first;
+        }
+        result.fingerprint = Xxh64(buffer.data(), buffer.size());
+        return result;
+}
+
+inline void DisplayContentHashes(ElfFile const& elf, ContentHashes const& hashes, JsonWriter& out){
+        auto const* filter = elf.filter.get();
+        out.BeginDocument();
+        for(auto const& _ : hashes.sections){
+                if( filter && ! filter->ShowSection(_.index) )
+                        continue;
+                out.BeginRecord("section_hash");
+                out.Field("section", _.index);
+                out.Field("name", elf.SectionName(elf.section_headers[_.index].sh_name));
+                out.Field("offset", _.offset);
+                out.Field("size", _.size);
+                if( _.missing )
+                        out.Field("error", "out of range");
+                else
+                        out.Field("xxh64", HashHex(_.hash));
+                if( _.excluded )
+                        out.Field("volatile", 1);
+                out.EndRecord();
+        }
+        for(auto const& _ : hashes.segments){
+                if( filter && ! filter->ShowSegment(elf.program_headers[_.index]) )
+                        continue;
+                out.BeginRecord("segment_hash");
+                out.Field("segment", _.index);
+                out.Field("p_vaddr", elf.program_headers[_.index].p_vaddr);
+                out.Field("offset", _.offset);
+                out.Field("size", _.size);
+                if( _.missing )
+                        out.Field("error", "out of range");
+                else
+                        out.Field("xxh64", HashHex(_.hash));
+                out.EndRecord();
+        }
+        out.BeginRecord("fingerprint");
+        out.Field("xxh64", HashHex(hashes.fingerprint));
+        out.Field("bytes", hashes.fingerprint_bytes);
+        out.Field("chunk_size", ContentHasher::ChunkSize);
+        out.EndRecord();
+        out.EndDocument();
+}
+
+} // end namespace celf
@@ -0,0 +1,230 @@
+#pragma once
+
+#include "celf/elf_file.h"
+#include "celf/symbol_index.h"
+#include "celf/notes.h"
+#include "celf/hash.h"
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <boost/filesystem.hpp>
+
+namespace celf{
+
+/*
+        Directory of serialized SymbolIndex arrays, one file per ELF file
+
+                header | ELF, section and program header tables |
+                names | slots | starts | outer | ranges
+
+        Entries are keyed by GNU build-id, or by device, inode, size and
+        mtime for files without one. The stored header tables must match
+        the file byte for byte, so a key collision is a miss rather than
+        a wrong answer. A file edited in place that kept its build-id and
+        layout is only caught with verify_contents, which compares the
+        XXH64 of the symbol tables and their string tables, at the cost
+        of reading all of them on every hit. Entries are written to a
+        temporary file and renamed into place, so readers never see a
+        partial one.
+
+        A hit maps the entry and borrows the arrays, nothing is rebuilt.
+        The arrays are in the native layout, the cache is not meant to be
+        shared between machines.
+ */
+class IndexCache{
+public:
+        explicit IndexCache(std::string dir):dir_{std::move(dir)}{}
+
+        // hashes the symbol and string tables on every hit, see above
+        bool verify_contents{false};
+
+        // the index of elf, from the cache when possible, otherwise built
+        // and stored for next time
+        SymbolIndex const& Symbols(ElfFile const& elf, ThreadPool* pool = nullptr){
+                std::call_once(elf.symbols_once_, [&](){
+                        auto index = Load(elf);
+                        if( index ){
+                                ++hits_;
+                        } else {
+                                ++misses_;
+                                index = std::make_shared<SymbolIndex>(elf, pool);
+                                Store(elf, *index);
+                        }
+                        elf.symbols_ = std::move(index);
+                });
+                return *elf.symbols_;
+        }
+
+        // empty when the file can't be keyed, ie it was parsed from memory
+        std::string PathFor(ElfFile const& elf)const{
+                auto build_id = BuildId(elf);
+                std::string key;
+                char buf[96];
+                if( ! build_id.empty() ){
+                        key = "b-" + HexBytes(build_id);
+                } else if( elf.identity.inode != 0 ){
+                        auto const& id = elf.identity;
+                        std::snprintf(buf, sizeof(buf), "f-%llx-%llx-%llx-%llx",
+                                      static_cast<unsigned long long>(id.device),
+                                      static_cast<unsigned long long>(id.inode),
+                                      static_cast<unsigned long long>(id.size),
+                                      static_cast<unsigned long long>(id.mtime_ns));
+                        key = buf;
+                } else {
+                        return std::string{};
+                }
+                return dir_ + "/" + key + ".idx";
+        }
+
+        std::shared_ptr<SymbolIndex> Load(ElfFile const& elf)const{
+                auto path = PathFor(elf);
+                if( path.empty() )
+                        return nullptr;
+                auto mret = MappedFile::Open(path, MapAdvice::Random);
+                auto mapping = boost::get<std::shared_ptr<MappedFile> >(&mret);
+                if( ! mapping )
+                        return nullptr;
+                auto view = (*mapping)->View();
+                if( view.size() < sizeof(Header) )
+                        return nullptr;
+                auto header = view.Read<Header>(0);
+                if( std::memcmp(header.magic, Magic(), sizeof(header.magic)) != 0 || header.version != Version )
+                        return nullptr;
+                if( header.file_size != elf.memory.size() )
+                        return nullptr;
+                auto tables = HeaderTables(elf);
+                if( header.tables.count != tables.size() || ! view.Contains(header.tables.offset, tables.size()) )
+                        return nullptr;
+                if( std::memcmp(view.data() + header.tables.offset, tables.data(), tables.size()) != 0 )
+                        return nullptr;
+                if( verify_contents && header.contents != ContentsHash(elf) )
+                        return nullptr;
+
+                using Index = SymbolIndex;
+                if( ! Fits<Index::NameEntry>(view, header.names) ||
+                    ! Fits<Index::Slot>(view, header.slots) ||
+                    ! Fits<Elf64_Xword>(view, header.starts) ||
+                    ! Fits<Elf64_Word>(view, header.outer) ||
+                    ! Fits<Index::Range>(view, header.ranges) )
+                        return nullptr;
+                if( header.slots.count == 0 ? header.mask != 0
+                                            : header.slots.count != header.mask + 1 || ( header.mask & ( header.mask + 1 ) ) != 0 )
+                        return nullptr;
+                if( header.starts.count != header.ranges.count || header.outer.count != header.ranges.count )
+                        return nullptr;
+
+                std::shared_ptr<SymbolIndex> index{new SymbolIndex{elf, SymbolIndex::Empty{}}};
+                index->storage_ = *mapping;
+                index->mask_ = header.mask;
+                Borrow(view, header.names, index->names_);
+                Borrow(view, header.slots, index->slots_);
+                Borrow(view, header.starts, index->starts_);
+                Borrow(view, header.outer, index->outer_);
+                Borrow(view, header.ranges, index->ranges_);
+                return index;
+        }
+
+        // best effort, a cache that can't be written is just a slower one
+        bool Store(ElfFile const& elf, SymbolIndex const& index)const{
+                auto path = PathFor(elf);
+                if( path.empty() )
+                        return false;
+                boost::system::error_code ec;
+                boost::filesystem::create_directories(dir_, ec);
+
+                Header header{};
+                std::memcpy(header.magic, Magic(), sizeof(header.magic));
+                header.version = Version;
+                header.file_size = elf.memory.size();
+                header.contents = ContentsHash(elf);
+                header.mask = index.mask_;
+
+                std::string blob(sizeof(Header), '\0');
+                auto append = [&](const void* data, size_t count, size_t size){
+                        blob.resize(( blob.size() + 7 ) & ~size_t{7}, '\0');
+                        Array array{blob.size(), count, size};
+                        blob.append(static_cast<const char*>(data), count * size);
+                        return array;
+                };
+                auto tables = HeaderTables(elf);
+                header.tables   = append(tables.data(), tables.size(), 1);
+                header.names    = append(index.names_.data(), index.names_.size(), sizeof(SymbolIndex::NameEntry));
+                header.slots    = append(index.slots_.data(), index.slots_.size(), sizeof(SymbolIndex::Slot));
+                header.starts   = append(index.starts_.data(), index.starts_.size(), sizeof(Elf64_Xword));
+                header.outer    = append(index.outer_.data(), index.outer_.size(), sizeof(Elf64_Word));
+                header.ranges   = append(index.ranges_.data(), index.ranges_.size(), sizeof(SymbolIndex::Range));
+                std::memcpy(&blob[0], &header, sizeof(header));
+
+                return WriteFileAtomically(path, {MemoryView{blob.data(), blob.size()}});
+        }
+
+        size_t Hits()const{ return hits_; }
+        size_t Misses()const{ return misses_; }
+private:
+        static const char* Magic(){ return "CELFIDX"; }
+        static constexpr std::uint64_t Version = 4;
+
+        struct Array{
+                std::uint64_t offset;
+                std::uint64_t count;
+                std::uint64_t size; // of an element
+        };
+        struct Header{
+                char magic[8];
+                std::uint64_t version;
+                std::uint64_t file_size;
+                // ContentsHash of the file
+                std::uint64_t contents;
+                std::uint64_t mask;
+                Array tables;
+                Array names;
+                Array slots;
+                Array starts;
+                Array outer;
+                Array ranges;
+        };
+
+        // the bytes the entry is validated against
+        static std::string HeaderTables(ElfFile const& elf){
+                std::string result(reinterpret_cast<const char*>(&elf.header), sizeof(elf.header));
+                auto sh = elf.section_headers.Memory();
+                result.append(sh.data(), sh.size());
+                auto ph = elf.program_headers.Memory();
+                result.append(ph.data(), ph.size());
+                return result;
+        }
+        // of every symbol table and the string table it links to, which
+        // is all the index holds offsets and addresses from
+        static std::uint64_t ContentsHash(ElfFile const& elf){
+                std::vector<MemoryView> views;
+                for(auto const& _ : elf.sections){
+                        auto symt = boost::get<SymbolTable>(&_);
+                        if( ! symt )
+                                continue;
+                        views.push_back(symt->View().Memory());
+                        if( symt->Link() < elf.sections.size() ){
+                                if( auto strtab = boost::get<StringTable>(&elf.sections[symt->Link()]) )
+                                        views.push_back(strtab->Memory());
+                        }
+                }
+                auto hashes = ContentHasher::Hash(views, nullptr);
+                return Xxh64(hashes.data(), hashes.size() * sizeof(std::uint64_t));
+        }
+        template<class T>
+        static bool Fits(MemoryView view, Array const& array){
+                if( array.size != sizeof(T) || array.offset % alignof(T) != 0 )
+                        return false;
+                return array.offset <= view.size() && array.count <= ( view.size() - array.offset ) / sizeof(T);
+        }
+        template<class T>
+        static void Borrow(MemoryView view, Array const& array, ArrayStore<T>& store){
+                store.Borrow(reinterpret_cast<const T*>(view.data() + array.offset), array.count);
+        }
+
+        std::string dir_;
+        std::atomic<size_t> hits_{0};
+        std::atomic<size_t> misses_{0};
+};
+
+} // end namespace celf
@@ -0,0 +1,807 @@
+#pragma once
+
+#include "celf/elf_file.h"
+#include "celf/symbol_index.h"
+#include "celf/thread_pool.h"
+#include "celf/stats.h"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <unistd.h>
+#include <boost/utility/string_view.hpp>
+
+namespace celf{
+
+/*
+        Buffered output to a file descriptor. With no descriptor the bytes
+        just accumulate in memory and can be taken with Take()
+ */
+struct OutputBuffer{
+        explicit OutputBuffer(int fd = -1, size_t capacity = 64 * 1024)
+                :fd_{fd}, capacity_{capacity}
+        {
+                buf_.reserve(capacity_);
+        }
+        ~OutputBuffer(){
+                try{
+                        Flush();
+                } catch(...){}
+        }
+        OutputBuffer(OutputBuffer const&)=delete;
+        OutputBuffer& operator=(OutputBuffer const&)=delete;
+
+        void Write(const char* data, size_t size){
+                if( fd_ != -1 && buf_.size() + size > capacity_ ){
+                        Flush();
+                        if( size >= capacity_ ){
+                                WriteAll(data, size);
+                                return;
+                        }
+                }
+                buf_.append(data, size);
+        }
+        void Write(boost::string_view s){
+                Write(s.data(), s.size());
+        }
+        void Put(char c){
+                if( fd_ != -1 && buf_.size() == capacity_ )
+                        Flush();
+                buf_.push_back(c);
+        }
+        void Flush(){
+                if( fd_ == -1 || buf_.empty() )
+                        return;
+                WriteAll(buf_.data(), buf_.size());
+                buf_.clear();
+        }
+        std::string Take(){
+                std::string result;
+                result.swap(buf_);
+                return result;
+        }
+private:
+        void WriteAll(const char* data, size_t size){
+                while( size != 0 ){
+                        auto ret = ::write(fd_, data, size);
+                        if( ret == -1 ){
+                                if( errno == EINTR )
+                                        continue;
+                                throw std::runtime_error(std::string{"write failed: "} + std::strerror(errno));
+                        }
+                        data += ret;
+                        size -= static_cast<size_t>(ret);
+                }
+        }
+
+        int fd_;
+        size_t capacity_;
+        std::string buf_;
+};
+
+enum class JsonStyle{
+        // one document, laid out the same as boost::property_tree::write_json
+        Pretty,
+        // one flat record per line, for piping into other tools
+        Lines,
+};
+
+/*
+        Streaming JSON writer, nothing is kept apart from the nesting
+        state, so memory use doesn't depend on the size of the document.
+
+        In Pretty style records and groups nest as objects and every value
+        is a string. In Lines style each record is written as its own line
+        tagged with "record", groups only close the enclosing record, and
+        numbers are written unquoted.
+ */
+struct JsonWriter{
+        JsonWriter(OutputBuffer& out, JsonStyle style)
+                :out_{&out}, style_{style}
+        {}
+
+        bool IsLines()const{ return style_ == JsonStyle::Lines; }
+
+        // added to every record in Lines style
+        void SetFile(boost::string_view file){
+                file_.assign(file.data(), file.size());
+        }
+
+        // writer for a part of the document that is rendered into its own
+        // buffer and added later with Append(). The fork starts in the
+        // current state, unless first is false, in which case something
+        // is assumed to come before it at the current level
+        JsonWriter Fork(OutputBuffer& out, bool first)const{
+                JsonWriter result{*this};
+                result.out_ = &out;
+                if( ! first && ! result.levels_.empty() )
+                        result.levels_.back().empty = false;
+                return result;
+        }
+        void Append(boost::string_view part){
+                if( part.empty() )
+                        return;
+                // a fork that assumed something came before it, where
+                // nothing did
+                if( ! IsLines() && ! levels_.empty() && levels_.back().empty && part.starts_with(",\n") ){
+                        out_->Write("{\n");
+                        part.remove_prefix(2);
+                }
+                out_->Write(part);
+                if( ! levels_.empty() )
+                        levels_.back().empty = false;
+        }
+
+        void BeginDocument(){
+                if( IsLines() )
+                        return;
+                levels_.push_back(Level{});
+        }
+        void EndDocument(){
+                if( IsLines() )
+                        return;
+                EndObject();
+                out_->Put('\n');
+        }
+
+        void BeginRecord(boost::string_view key){
+                if( ! IsLines() ){
+                        BeginObject(key);
+                        return;
+                }
+                out_->Write("{\"record\":");
+                String(key);
+                if( ! file_.empty() ){
+                        out_->Write(",\"file\":");
+                        String(file_);
+                }
+                records_.push_back(true);
+        }
+        void EndRecord(){
+                if( ! IsLines() ){
+                        EndObject();
+                        return;
+                }
+                if( records_.back() )
+                        out_->Write("}\n");
+                records_.pop_back();
+        }
+
+        void BeginGroup(boost::string_view key){
+                if( ! IsLines() ){
+                        BeginObject(key);
+                        return;
+                }
+                if( ! records_.empty() && records_.back() ){
+                        out_->Write("}\n");
+                        records_.back() = false;
+                }
+        }
+        void EndGroup(){
+                if( ! IsLines() )
+                        EndObject();
+        }
+
+        void Field(boost::string_view key, boost::string_view value){
+                Key(key);
+                String(value);
+        }
+        void Field(boost::string_view key, const char* value){
+                Field(key, boost::string_view{value});
+        }
+        void Field(boost::string_view key, std::string const& value){
+                Field(key, boost::string_view{value});
+        }
+        void Field(boost::string_view key, char value){
+                Field(key, boost::string_view{&value, 1});
+        }
+        // printed the same way std::ostream prints a pointer
+        void Field(boost::string_view key, Elf64_Addr value){
+                char buf[24];
+                auto x = ToXword(value);
+                if( x == 0 ){
+                        Field(key, boost::string_view{"0"});
+                        return;
+                }
+                char* last = buf + sizeof(buf);
+                char* first = last;
+                for(; x != 0; x >>= 4 )
+                        *--first = "0123456789abcdef"[x & 0xf];
+                *--first = 'x';
+                *--first = '0';
+                Field(key, boost::string_view{first, static_cast<size_t>(last - first)});
+        }
+        template<class T, class = std::enable_if_t<std::is_integral<T>::value> >
+        void Field(boost::string_view key, T value){
+                char buf[24];
+                char* last = buf + sizeof(buf);
+                char* first = last;
+                bool negative = value < 0;
+                auto x = negative ? 0 - static_cast<std::uint64_t>(value) : static_cast<std::uint64_t>(value);
+                do{
+                        *--first = static_cast<char>('0' + x % 10);
+                        x /= 10;
+                }while( x != 0 );
+                if( negative )
+                        *--first = '-';
+                Key(key);
+                if( IsLines() ){
+                        out_->Write(first, static_cast<size_t>(last - first));
+                } else {
+                        out_->Put('"');
+                        out_->Write(first, static_cast<size_t>(last - first));
+                        out_->Put('"');
+                }
+        }
+private:
+        struct Level{
+                // the opening brace is only written with the first child,
+                // an object with no children is written as "" like ptree
+                bool empty{true};
+        };
+
+        void BeginObject(boost::string_view key){
+                Key(key);
+                levels_.push_back(Level{});
+        }
+        void EndObject(){
+                bool empty = levels_.back().empty;
+                levels_.pop_back();
+                if( empty ){
+                        if( levels_.empty() )
+                                out_->Write("{\n}");
+                        else
+                                out_->Write("\"\"");
+                        return;
+                }
+                out_->Put('\n');
+                Indent(levels_.size());
+                out_->Put('}');
+        }
+        void Key(boost::string_view key){
+                if( IsLines() ){
+                        out_->Put(',');
+                        String(key);
+                        out_->Put(':');
+                        return;
+                }
+                auto& level = levels_.back();
+                out_->Write(level.empty ? "{\n" : ",\n");
+                level.empty = false;
+                Indent(levels_.size());
+                String(key);
+                out_->Write(": ");
+        }
+        void Indent(size_t depth){
+                for(size_t i=0;i!=depth;++i)
+                        out_->Write("    ");
+        }
+        // same escaping as ptree, bytes outside ASCII are passed through
+        void String(boost::string_view s){
+                out_->Put('"');
+                auto first = s.data();
+                auto last = first + s.size();
+                auto run = first;
+                for(; first != last; ++first){
+                        auto c = static_cast<unsigned char>(*first);
+                        if( c >= 0x20 && c != '"' && c != '/' && c != '\\' )
+                                continue;
+                        out_->Write(run, static_cast<size_t>(first - run));
+                        run = first + 1;
+                        switch(c){
+                        case '\b': out_->Write("\\b"); break;
+                        case '\f': out_->Write("\\f"); break;
+                        case '\n': out_->Write("\\n"); break;
+                        case '\r': out_->Write("\\r"); break;
+                        case '\t': out_->Write("\\t"); break;
+                        case '/':  out_->Write("\\/"); break;
+                        case '"':  out_->Write("\\\""); break;
+                        case '\\': out_->Write("\\\\"); break;
+                        default:
+                                char buf[6] = { '\\', 'u', '0', '0',
+                                                "0123456789ABCDEF"[c >> 4],
+                                                "0123456789ABCDEF"[c & 0xf] };
+                                out_->Write(buf, sizeof(buf));
+                                break;
+                        }
+                }
+                out_->Write(run, static_cast<size_t>(last - run));
+                out_->Put('"');
+        }
+
+        OutputBuffer* out_;
+        JsonStyle style_;
+        std::string file_;
+        std::vector<Level> levels_;
+        // Lines style, whether each open record still has its line open
+        std::vector<bool> records_;
+};
+
+inline void DisplayHeader(Elf64_Ehdr const& header, JsonWriter& out){
+        out.BeginRecord("header");
+        out.Field("EI_MAG0", (int)header.e_ident[EI_MAG0]);
+        out.Field("EI_MAG1", (char)header.e_ident[EI_MAG1]);
+        out.Field("EI_MAG2", (char)header.e_ident[EI_MAG2]);
+        out.Field("EI_MAG3", (char)header.e_ident[EI_MAG3]);
+        out.Field("EI_CLASS", ElfDataClass(header.e_ident[EI_CLASS]).Name());
+        out.Field("EI_DATA", ElfDataEncoding(header.e_ident[EI_DATA]).Name());
+        out.Field("EI_VERSION", (int)header.e_ident[EI_VERSION]);
+        out.Field("EI_OSABI", ElfOSABI(header.e_ident[EI_OSABI]).Name());
+        out.Field("EI_ABIVERSION", (int)header.e_ident[EI_ABIVERSION]);
+        out.Field("EI_PAD", (int)header.e_ident[EI_PAD]);
+        out.Field("EI_NIDENT", (int)header.e_ident[EI_NIDENT]);
+        
+        out.Field("e_type", ElfObjectType(header.e_type).Name());
+        out.Field("e_machine", header.e_machine);
+        out.Field("e_version", header.e_version);
+        out.Field("e_entry", header.e_entry);
+        out.Field("e_phoff", header.e_phoff);
+        out.Field("e_shoff", header.e_shoff);
+        out.Field("e_flags", header.e_flags);
+        out.Field("e_ehsize", header.e_ehsize);
+        out.Field("e_phentsize", header.e_phentsize);
+        out.Field("e_phnum", header.e_phnum);
+        out.Field("e_shentsize", header.e_shentsize);
+        out.Field("e_shnum", header.e_shnum);
+        out.Field("e_shstrndx", header.e_shstrndx);  
+        out.EndRecord();
+}
+
+inline void DisplayHeader(ElfFile const& elf, JsonWriter& out){
+        DisplayHeader(elf.header, out);
+}
+
+// the fields of a section record, without its data
+inline void DisplaySectionHeader(ElfFile const& elf, size_t i, JsonWriter& out){
+        auto const& sh = elf.section_headers[i];
+        MaskBuffer flags;
+        out.Field("__index"     , i);
+        out.Field("sh_type"     , ElfSectionType(sh.sh_type).Name());
+        out.Field("sh_name"     , elf.SectionName(sh.sh_name));
+        out.Field("sh_flags"    , ElfSectionAttributes.MaskToString(sh.sh_flags, flags));
+        out.Field("sh_addr"     , sh.sh_addr);
+        out.Field("sh_offset"   , sh.sh_offset);
+        out.Field("sh_size"     , sh.sh_size);
+        out.Field("sh_link"     , sh.sh_link);
+        out.Field("sh_info"     , sh.sh_info);
+        out.Field("sh_addralign", sh.sh_addralign);
+        out.Field("sh_entsize"  , sh.sh_entsize);  
+        if( auto chdr = elf.CompressionHeader(i) ){
+                out.Field("ch_type"     , ElfCompressionType(chdr->ch_type).Name());
+                out.Field("ch_size"     , chdr->ch_size);
+                out.Field("ch_addralign", chdr->ch_addralign);
+        }
+}
+
+// symbols [first, last) of the table in section i
+inline void DisplaySymbols(ElfFile const& elf, size_t i, SymbolTable const& symt,
+                           size_t first, size_t last, JsonWriter& out){
+        auto const* filter = elf.filter.get();
+        for(size_t idx=first;idx!=last;++idx){
+                auto _ = symt[idx];
+                if( filter && ! filter->ShowSymbol(elf, symt, _) )
+                        continue;
+                boost::string_view s;
+                if( _.st_name != 0 )
+                        s = elf.LookupName( symt.Link(), _.st_name);
+                out.BeginRecord("sym");
+                if( out.IsLines() ){
+                        out.Field("__section", i);
+                        out.Field("__index", _.Index());
+                }
+                out.Field("st_name", s);
+                out.Field("st_info", (int)_.st_info);
+                out.Field("upper(st_info)", ElfSymbolBinding(_.Binding()).Name());
+                out.Field("lower(st_info)", ElfSymbolTypes(_.Type()).Name());
+                out.Field("st_other", (int)_.st_other);
+                if( _.IsSpecialSection() ){
+                        out.Field("st_shndx", ElfSymbolType(_.st_shndx).Name());
+                } else {
+                        out.Field("st_shndx", _.SectionIndex());
+                }
+                out.Field("st_value", _.st_value);
+                out.Field("st_size", _.st_size);
+                out.EndRecord();
+        }
+}
+
+// the name of symbol idx of symt, a section symbol by its section's
+inline boost::string_view RelocationSymbolName(ElfFile const& elf, SymbolTable const& symt, Elf64_Word idx){
+        auto sym = symt[idx];
+        if( sym.st_name != 0 )
+                return elf.LookupName(symt.Link(), sym.st_name);
+        if( sym.Type() == STT_SECTION && sym.SectionIndex() < elf.section_headers.size() )
+                return elf.SectionName(elf.section_headers[sym.SectionIndex()].sh_name);
+        return boost::string_view{};
+}
+
+// relocations [first, last) of the table in section i, with the name of
+// the symbol each refers to
+inline void DisplayRelocations(ElfFile const& elf, size_t i, RelocationTable const& relt,
+                               size_t first, size_t last, JsonWriter& out){
+        SymbolTable const* symt = nullptr;
+        if( relt.Link() < elf.sections.size() )
+                symt = boost::get<SymbolTable>(&elf.sections[relt.Link()]);
+        bool x86_64 = elf.header.e_machine == EM_X86_64;
+        for(size_t idx=first;idx!=last;++idx){
+                auto _ = relt[idx];
+                out.BeginRecord("rel");
+                if( out.IsLines() ){
+                        out.Field("__section", i);
+                        out.Field("__index", idx);
+                }
+                out.Field("r_offset", ToAddr(_.r_offset));
+                out.Field("r_sym", _.Symbol());
+                if( x86_64 )
+                        out.Field("r_type", ElfRelocationX86_64(_.Type()).Name());
+                else
+                        out.Field("r_type", _.Type());
+                if( relt.HasAddends() )
+                        out.Field("r_addend", _.r_addend);
+                if( symt && _.Symbol() != 0 && _.Symbol() < symt->size() ){
+                        auto name = RelocationSymbolName(elf, *symt, _.Symbol());
+                        if( ! name.empty() )
+                                out.Field("sym_name", name);
+                }
+                out.EndRecord();
+        }
+}
+
+// entries of the dynamic section i, with the name string valued tags
+// refer to
+inline void DisplayDynamic(ElfFile const& elf, size_t i, DynamicTable const& dynt, JsonWriter& out){
+        StringTable const* strtab = nullptr;
+        if( dynt.Link() < elf.sections.size() )
+                strtab = boost::get<StringTable>(&elf.sections[dynt.Link()]);
+        for(size_t idx=0;idx!=dynt.size();++idx){
+                auto _ = dynt[idx];
+                out.BeginRecord("dyn");
+                if( out.IsLines() ){
+                        out.Field("__section", i);
+                        out.Field("__index", idx);
+                }
+                out.Field("d_tag", ElfDynamicTag(_.d_tag).Name());
+                out.Field("d_val", ToAddr(_.d_val));
+                switch(_.d_tag){
+                case DT_NEEDED:
+                case DT_SONAME:
+                case DT_RPATH:
+                case DT_RUNPATH:
+                        if( strtab && _.d_val < strtab->Memory().size() )
+                                out.Field("name", strtab->At(static_cast<Elf64_Word>(_.d_val)));
+                        break;
+                }
+                out.EndRecord();
+        }
+}
+
+// strings starting in the byte range [first, last) of the table in section i
+inline void DisplayStrings(size_t i, StringTable const& st, size_t first, size_t last, JsonWriter& out){
+        for(auto iter = st.IteratorAt(first), end = st.end(); iter != end && iter.Offset() < last; ++iter){
+                if( out.IsLines() ){
+                        out.BeginRecord("names");
+                        out.Field("__section", i);
+                        out.Field("__offset", iter.Offset());
+                        out.Field("value", *iter);
+                        out.EndRecord();
+                } else {
+                        out.Field("names", *iter);
+                }
+        }
+}
+
+inline void DisplaySection(ElfFile const& elf, size_t i, JsonWriter& out){
+        out.BeginRecord("section_headers");
+        DisplaySectionHeader(elf, i, out);
+
+        struct Visitor : boost::static_visitor<void>{
+                void operator()(Nothing const& )const{}
+                void operator()(SymbolTable const& symt)const{
+                        out_->BeginGroup("data");
+                        DisplaySymbols(*elf_, i_, symt, 0, symt.size(), *out_);
+                        out_->EndGroup();
+                }
+                void operator()(StringTable const& st)const{
+                        out_->BeginGroup("data");
+                        DisplayStrings(i_, st, 0, st.Memory().size(), *out_);
+                        out_->EndGroup();
+                }
+                void operator()(RelocationTable const& relt)const{
+                        out_->BeginGroup("data");
+                        DisplayRelocations(*elf_, i_, relt, 0, relt.size(), *out_);
+                        out_->EndGroup();
+                }
+                void operator()(DynamicTable const& dynt)const{
+                        out_->BeginGroup("data");
+                        DisplayDynamic(*elf_, i_, dynt, *out_);
+                        out_->EndGroup();
+                }
+                size_t i_;
+                ElfFile const* elf_;
+                JsonWriter* out_;
+        };
+        Visitor v;
+        v.i_ = i;
+        v.elf_ = &elf;
+        v.out_ = &out;
+        boost::apply_visitor(v, elf.sections[i]);
+        
+        out.EndRecord();
+}
+
+inline void DisplayProgramHeader(Elf64_Phdr const& ph, size_t i, JsonWriter& out){
+        MaskBuffer flags;
+        out.BeginRecord("program_headers");
+        out.Field("__index"     , i);
+        out.Field("p_type", ElfSegmentType(ph.p_type).Name());
+        out.Field("p_flags", ElfSegmentAttributes.MaskToString(ph.p_flags, flags));
+        out.Field("p_offset", ph.p_offset);
+        out.Field("p_vaddr", ph.p_vaddr);
+        out.Field("p_paddr", ph.p_paddr);
+        out.Field("p_filesz", ph.p_filesz);
+        out.Field("p_memsz", ph.p_memsz);
+        out.Field("p_align", ph.p_align);  
+        out.EndRecord();
+}
+
+inline void DisplayProgramHeader(ElfFile const& elf, size_t i, JsonWriter& out){
+        DisplayProgramHeader(elf.program_headers[i], i, out);
+}
+
+struct DisplayOptions{
+        // renders sections and chunks of large tables in parallel
+        ThreadPool* pool{nullptr};
+        size_t symbols_per_chunk{16 * 1024};
+        size_t relocations_per_chunk{16 * 1024};
+        size_t string_bytes_per_chunk{1024 * 1024};
+        // records the display phases and every section when set
+        Stats* stats{nullptr};
+};
+
+/*
+        Renders the parts in parallel into separate buffers, then appends
+        them to out in order. The parts are done in waves of a few per
+        thread, so only a bounded amount of output is buffered.
+ */
+template<class F>
+void DisplayParallel(ThreadPool& pool, size_t count, JsonWriter& out, F const& render){
+        size_t wave = 2 * pool.size();
+        for(size_t first=0;first < count;first += wave){
+                size_t last = std::min(count, first + wave);
+                std::vector<std::string> parts(last - first);
+                TaskGroup group{&pool};
+                for(size_t idx=first;idx!=last;++idx){
+                        group.Run([&, idx](){
+                                OutputBuffer buffer;
+                                // any part may come out empty, Append
+                                // puts the brace on the first that isn't
+                                auto fork = out.Fork(buffer, false);
+                                render(idx, fork);
+                                parts[idx - first] = buffer.Take();
+                        });
+                }
+                group.Wait();
+                for(auto const& _ : parts)
+                        out.Append(_);
+        }
+}
+
+inline void PrettyDisplay(ElfFile const& elf, JsonWriter& out, DisplayOptions const& opts = DisplayOptions{}){
+        StatsScope display_scope{opts.stats, "display", elf.memory.size()};
+        out.BeginDocument();
+
+        auto const* filter = elf.filter.get();
+        if( ! filter || filter->Header() ){
+                StatsScope scope{opts.stats, "display.header", sizeof(Elf64_Ehdr)};
+                DisplayHeader(elf, out);
+        }
+        auto shown = [&](size_t i){
+                return ! filter || filter->ShowSection(i);
+        };
+        // only looked up when recording
+        auto section_name = [&](size_t i){
+                return opts.stats ? elf.SectionName(elf.section_headers[i].sh_name) : boost::string_view{};
+        };
+        auto section_size = [&](size_t i)->size_t{
+                return elf.section_headers[i].sh_size;
+        };
+
+        auto symbol_step = std::max<size_t>(opts.symbols_per_chunk, 1);
+        auto string_step = std::max<size_t>(opts.string_bytes_per_chunk, 1);
+        auto relocation_step = std::max<size_t>(opts.relocations_per_chunk, 1);
+        auto chunks = [&](size_t i)->size_t{
+                if( auto ptr = boost::get<SymbolTable>(&elf.sections[i]) )
+                        return ( ptr->size() + symbol_step - 1 ) / symbol_step;
+                if( auto ptr = boost::get<RelocationTable>(&elf.sections[i]) )
+                        return ( ptr->size() + relocation_step - 1 ) / relocation_step;
+                if( auto ptr = boost::get<StringTable>(&elf.sections[i]) )
+                        return ( ptr->Memory().size() + string_step - 1 ) / string_step;
+                return 1;
+        };
+
+        size_t count = elf.section_headers.size();
+        for(size_t i=0;i!=count;){
+                if( ! shown(i) ){
+                        ++i;
+                        continue;
+                }
+                if( ! opts.pool ){
+                        StatsScope scope{opts.stats, "display.section", section_name(i), section_size(i)};
+                        DisplaySection(elf, i, out);
+                        ++i;
+                        continue;
+                }
+                if( chunks(i) <= 1 ){
+                        // a run of small sections, each rendered as a whole
+                        size_t last = i;
+                        for(; last != count && chunks(last) <= 1; ++last);
+                        DisplayParallel(*opts.pool, last - i, out, [&](size_t idx, JsonWriter& fork){
+                                if( ! shown(i + idx) )
+                                        return;
+                                StatsScope scope{opts.stats, "display.section", section_name(i + idx), section_size(i + idx)};
+                                DisplaySection(elf, i + idx, fork);
+                        });
+                        i = last;
+                        continue;
+                }
+                // a large table, split into chunks joined back in order
+                StatsScope scope{opts.stats, "display.section", section_name(i), section_size(i)};
+                out.BeginRecord("section_headers");
+                DisplaySectionHeader(elf, i, out);
+                out.BeginGroup("data");
+                if( auto ptr = boost::get<SymbolTable>(&elf.sections[i]) ){
+                        auto step = symbol_step;
+                        DisplayParallel(*opts.pool, chunks(i), out, [&](size_t idx, JsonWriter& fork){
+                                DisplaySymbols(elf, i, *ptr, idx * step,
+                                               std::min(ptr->size(), ( idx + 1 ) * step), fork);
+                        });
+                } else if( auto ptr = boost::get<RelocationTable>(&elf.sections[i]) ){
+                        auto step = relocation_step;
+                        DisplayParallel(*opts.pool, chunks(i), out, [&](size_t idx, JsonWriter& fork){
+                                DisplayRelocations(elf, i, *ptr, idx * step,
+                                                   std::min(ptr->size(), ( idx + 1 ) * step), fork);
+                        });
+                } else if( auto ptr = boost::get<StringTable>(&elf.sections[i]) ){
+                        auto step = string_step;
+                        DisplayParallel(*opts.pool, chunks(i), out, [&](size_t idx, JsonWriter& fork){
+                                DisplayStrings(i, *ptr, idx * step,
+                                               std::min(ptr->Memory().size(), ( idx + 1 ) * step), fork);
+                        });
+                }
+                out.EndGroup();
+                out.EndRecord();
+                ++i;
+        }
+        
+        {
+                StatsScope scope{opts.stats, "display.program_headers",
+                                 elf.program_headers.size() * sizeof(Elf64_Phdr)};
+                for(size_t i=0;i!=elf.program_headers.size();++i){
+                        if( filter && ! filter->ShowSegment(elf.program_headers[i]) )
+                                continue;
+                        DisplayProgramHeader(elf, i, out);
+                }
+        }
+
+        out.EndDocument();
+}
+
+/*
+        Per relocation section, a record with the entry count, one per
+        relocation type, and one for each of the top most referenced
+        symbols. Everything comes from one pass over each table
+ */
+inline void DisplayRelocationSummary(ElfFile const& elf, size_t top, JsonWriter& out){
+        auto const* filter = elf.filter.get();
+        bool x86_64 = elf.header.e_machine == EM_X86_64;
+        out.BeginDocument();
+        for(size_t i=0;i!=elf.sections.size();++i){
+                auto relt = boost::get<RelocationTable>(&elf.sections[i]);
+                if( ! relt || ( filter && ! filter->ShowSection(i) ) )
+                        continue;
+                auto section = elf.SectionName(elf.section_headers[i].sh_name);
+                out.BeginRecord("relocations");
+                out.Field("section", i);
+                out.Field("name", section);
+                out.Field("count", relt->size());
+                if( relt->Info() != 0 && relt->Info() < elf.section_headers.size() )
+                        out.Field("applies_to", elf.SectionName(elf.section_headers[relt->Info()].sh_name));
+                out.EndRecord();
+
+                for(auto const& _ : relt->CountByType()){
+                        out.BeginRecord("relocation_type");
+                        out.Field("section", i);
+                        if( x86_64 )
+                                out.Field("r_type", ElfRelocationX86_64(_.first).Name());
+                        else
+                                out.Field("r_type", _.first);
+                        out.Field("count", _.second);
+                        out.EndRecord();
+                }
+
+                SymbolTable const* symt = nullptr;
+                if( relt->Link() < elf.sections.size() )
+                        symt = boost::get<SymbolTable>(&elf.sections[relt->Link()]);
+                if( ! symt || top == 0 )
+                        continue;
+                auto counts = relt->CountBySymbol(symt->size());
+                std::vector<Elf64_Word> referenced;
+                // symbol 0 is no symbol at all
+                for(size_t idx=1;idx<counts.size();++idx){
+                        if( counts[idx] != 0 )
+                                referenced.push_back(static_cast<Elf64_Word>(idx));
+                }
+                auto last = referenced.begin() + std::min(top, referenced.size());
+                std::partial_sort(referenced.begin(), last, referenced.end(), [&](Elf64_Word l, Elf64_Word r){
+                        return counts[l] != counts[r] ? counts[l] > counts[r] : l < r;
+                });
+                for(auto iter = referenced.begin(); iter != last; ++iter){
+                        auto name = RelocationSymbolName(elf, *symt, *iter);
+                        out.BeginRecord("relocation_target");
+                        out.Field("section", i);
+                        out.Field("r_sym", *iter);
+                        if( ! name.empty() )
+                                out.Field("sym_name", name);
+                        out.Field("count", counts[*iter]);
+                        out.EndRecord();
+                }
+        }
+        out.EndDocument();
+}
+
+/*
+        Resolves a symbol name, or an address written as 0x..., through the
+        symbol index
+ */
+inline void DisplayLookup(ElfFile const& elf, SymbolIndex const& index, boost::string_view query, JsonWriter& out){
+        boost::optional<SymbolRef> ref;
+        if( query.starts_with("0x") || query.starts_with("0X") ){
+                auto addr = std::strtoull(query.to_string().c_str(), nullptr, 16);
+                ref = index.FindByAddress(addr);
+        } else {
+                ref = index.FindByName(query);
+        }
+        out.BeginRecord("lookup");
+        out.Field("query", query);
+        if( ref ){
+                auto sym = index.Get(*ref);
+                out.Field("section", ref->section);
+                out.Field("index", ref->index);
+                out.Field("name", index.Name(*ref));
+                out.Field("st_value", sym.st_value);
+                out.Field("st_size", sym.st_size);
+                out.Field("binding", ElfSymbolBinding(sym.Binding()).Name());
+                out.Field("type", ElfSymbolTypes(sym.Type()).Name());
+        }
+        out.EndRecord();
+}
+
+// one stats record per phase, times in nanoseconds
+inline void DisplayStats(Stats const& stats, JsonWriter& out){
+        out.BeginDocument();
+        for(auto const& _ : stats.Records()){
+                out.BeginRecord("stats");
+                out.Field("phase", _.phase);
+                if( ! _.detail.empty() )
+                        out.Field("detail", _.detail);
+                out.Field("wall_ns", static_cast<std::uint64_t>(_.wall * 1e9));
+                out.Field("cpu_ns", static_cast<std::uint64_t>(_.cpu * 1e9));
+                out.Field("bytes", _.bytes);
+                out.Field("allocations", _.allocations);
+                out.Field("allocated_bytes", _.allocated_bytes);
+                out.EndRecord();
+        }
+        out.EndDocument();
+}
+
+inline void PrettyDisplay(ElfFile const& elf){
+        OutputBuffer buffer{STDOUT_FILENO};
+        JsonWriter out{buffer, JsonStyle::Pretty};
+        PrettyDisplay(elf, out);
+}
+
+} // end namespace celf
@@ -0,0 +1,301 @@
+#pragma once
+
+#include "celf/arena.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <memory>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+#include <atomic>
+#include <boost/variant.hpp>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace celf{
+
+/*
+        Read-only view over a block of bytes, which is either a mapping of
+        the file or a buffer owned by the ElfFile
+ */
+struct MemoryView{
+        MemoryView()=default;
+        MemoryView(const char* data, size_t size):data_{data}, size_{size}{}
+
+        const char* data()const{ return data_; }
+        size_t size()const{ return size_; }
+        bool empty()const{ return size_ == 0; }
+        const char* begin()const{ return data_; }
+        const char* end()const{ return data_ + size_; }
+
+        bool Contains(size_t offset, size_t len)const{
+                return offset <= size_ && len <= size_ - offset;
+        }
+        MemoryView Slice(size_t offset, size_t len)const{
+                if( ! Contains(offset, len) )
+                        throw std::domain_error("out of range");
+                return MemoryView{data_ + offset, len};
+        }
+        // structures inside the file have no alignment guarantee, so
+        // everything is copied out with memcpy
+        template<class T>
+        T Read(size_t offset)const{
+                if( ! Contains(offset, sizeof(T)) )
+                        throw std::domain_error("out of range");
+                T result;
+                std::memcpy(&result, data_ + offset, sizeof(T));
+                return result;
+        }
+private:
+        const char* data_{nullptr};
+        size_t size_{0};
+};
+
+/*
+        Table of fixed size entries, each entry is decoded when it's
+        accessed rather than copied out up front
+ */
+template<class T>
+struct TableView{
+        TableView()=default;
+        TableView(MemoryView mem, size_t entsize, size_t count)
+                :mem_{mem}, entsize_{entsize}, count_{count}
+        {
+                if( entsize_ < sizeof(T) || ! mem_.Contains(0, entsize_ * count_) )
+                        throw std::domain_error("table out of range");
+        }
+
+        size_t size()const{ return count_; }
+        bool empty()const{ return count_ == 0; }
+        size_t EntrySize()const{ return entsize_; }
+        MemoryView Memory()const{ return mem_; }
+
+        T operator[](size_t idx)const{
+                T result;
+                std::memcpy(&result, mem_.data() + idx * entsize_, sizeof(T));
+                return result;
+        }
+        T at(size_t idx)const{
+                if( idx >= count_ )
+                        throw std::out_of_range("table index out of range");
+                return (*this)[idx];
+        }
+
+        struct const_iterator{
+                using iterator_category = std::forward_iterator_tag;
+                using value_type        = T;
+                using difference_type   = std::ptrdiff_t;
+                using pointer           = T const*;
+                using reference         = T;
+
+                const_iterator(TableView const* table, size_t idx):table_{table}, idx_{idx}{}
+                T operator*()const{ return (*table_)[idx_]; }
+                const_iterator& operator++(){ ++idx_; return *this; }
+                bool operator==(const_iterator const& that)const{ return idx_ == that.idx_; }
+                bool operator!=(const_iterator const& that)const{ return idx_ != that.idx_; }
+        private:
+                TableView const* table_;
+                size_t idx_;
+        };
+        const_iterator begin()const{ return const_iterator{this, 0}; }
+        const_iterator end()const{ return const_iterator{this, count_}; }
+private:
+        MemoryView mem_;
+        size_t entsize_{sizeof(T)};
+        size_t count_{0};
+};
+
+/*
+        Contiguous array that either owns its elements or borrows them from
+        memory kept alive elsewhere, such as a mapped cache file
+ */
+template<class T>
+struct ArrayStore{
+        ArrayStore()=default;
+        ArrayStore(ArrayStore const&)=delete;
+        ArrayStore& operator=(ArrayStore const&)=delete;
+
+        void Assign(std::vector<T> values){
+                owned_ = std::move(values);
+                data_ = owned_.data();
+                size_ = owned_.size();
+        }
+        void Borrow(const T* data, size_t size){
+                owned_.clear();
+                owned_.shrink_to_fit();
+                data_ = data;
+                size_ = size;
+        }
+
+        const T* data()const{ return data_; }
+        size_t size()const{ return size_; }
+        bool empty()const{ return size_ == 0; }
+        const T* begin()const{ return data_; }
+        const T* end()const{ return data_ + size_; }
+        T const& operator[](size_t idx)const{ return data_[idx]; }
+        // owned elements only, borrowed ones belong to someone else
+        size_t HeapBytes()const{ return owned_.capacity() * sizeof(T); }
+private:
+        std::vector<T> owned_;
+        const T* data_{nullptr};
+        size_t size_{0};
+};
+
+// what a mapping was made from, to tell when the file changes
+struct FileIdentity{
+        std::uint64_t device{0};
+        std::uint64_t inode{0};
+        std::uint64_t size{0};
+        std::uint64_t mtime_ns{0};
+
+        static FileIdentity Of(struct stat const& st){
+                FileIdentity result;
+                result.device = st.st_dev;
+                result.inode = st.st_ino;
+                result.size = static_cast<std::uint64_t>(st.st_size);
+                result.mtime_ns = static_cast<std::uint64_t>(st.st_mtim.tv_sec) * 1000000000u + st.st_mtim.tv_nsec;
+                return result;
+        }
+        bool operator==(FileIdentity const& that)const{
+                return device == that.device && inode == that.inode &&
+                       size == that.size && mtime_ns == that.mtime_ns;
+        }
+        bool operator!=(FileIdentity const& that)const{
+                return ! ( *this == that );
+        }
+};
+
+enum class MapAdvice{
+        Normal,
+        Sequential,
+        Random,
+        WillNeed,
+};
+
+/*
+        Read-only private mapping of a whole file. Nothing is read until
+        the pages are touched, so a large file only costs what's used
+ */
+struct MappedFile{
+        using ResultType = boost::variant<
+               std::shared_ptr<MappedFile>,
+               std::string
+        >;
+        // the MappedFile and its reference count live in arena when set
+        static ResultType Open(std::string const& filename, MapAdvice advice = MapAdvice::Normal,
+                               Arena* arena = nullptr){
+                int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+                if( fd == -1 )
+                        return "Unable to open " + filename + ": " + std::strerror(errno);
+                struct stat st;
+                if( ::fstat(fd, &st) != 0 ){
+                        std::string msg = "Unable to stat " + filename + ": " + std::strerror(errno);
+                        ::close(fd);
+                        return msg;
+                }
+                if( ! S_ISREG(st.st_mode) ){
+                        ::close(fd);
+                        return filename + " is not a regular file";
+                }
+                size_t size = static_cast<size_t>(st.st_size);
+                void* addr = nullptr;
+                if( size != 0 ){
+                        addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                        if( addr == MAP_FAILED ){
+                                std::string msg = "Unable to map " + filename + ": " + std::strerror(errno);
+                                ::close(fd);
+                                return msg;
+                        }
+                }
+                // the mapping holds its own reference to the file
+                ::close(fd);
+                std::shared_ptr<MappedFile> result;
+                if( arena ){
+                        auto ptr = new(arena->Allocate(sizeof(MappedFile), alignof(MappedFile)))
+                                MappedFile{addr, size, FileIdentity::Of(st)};
+                        result = std::shared_ptr<MappedFile>(ptr, ArenaDelete<MappedFile>{arena},
+                                                             ArenaAllocator<MappedFile>{arena});
+                } else {
+                        result.reset(new MappedFile{addr, size, FileIdentity::Of(st)});
+                }
+                result->Advise(advice);
+                return result;
+        }
+        ~MappedFile(){
+                if( addr_ )
+                        ::munmap(addr_, size_);
+        }
+        MappedFile(MappedFile const&)=delete;
+        MappedFile& operator=(MappedFile const&)=delete;
+
+        MemoryView View()const{
+                return MemoryView{static_cast<const char*>(addr_), size_};
+        }
+        FileIdentity const& Identity()const{ return identity_; }
+        void Advise(MapAdvice advice)const{
+                Advise(advice, 0, size_);
+        }
+        // hints are best effort, a failing madvise is ignored
+        void Advise(MapAdvice advice, size_t offset, size_t len)const{
+                if( ! addr_ || offset >= size_ )
+                        return;
+                len = std::min(len, size_ - offset);
+                static const size_t page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+                size_t first = offset - offset % page_size;
+                len += offset - first;
+                int native = MADV_NORMAL;
+                switch(advice){
+                case MapAdvice::Normal:     native = MADV_NORMAL; break;
+                case MapAdvice::Sequential: native = MADV_SEQUENTIAL; break;
+                case MapAdvice::Random:     native = MADV_RANDOM; break;
+                case MapAdvice::WillNeed:   native = MADV_WILLNEED; break;
+                }
+                ::madvise(static_cast<char*>(addr_) + first, len, native);
+        }
+private:
+        MappedFile(void* addr, size_t size, FileIdentity identity)
+                :addr_{addr}, size_{size}, identity_{identity}
+        {}
+
+        void* addr_;
+        size_t size_;
+        FileIdentity identity_;
+};
+
+// writes the parts one after another to a temporary file and renames it
+// to path, so readers see either the old file or the whole new one
+inline bool WriteFileAtomically(std::string const& path, std::vector<MemoryView> const& parts){
+        static std::atomic<unsigned> counter{0};
+        auto tmp = path + ".tmp." + std::to_string(::getpid()) + "." + std::to_string(counter++);
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if( fd == -1 )
+                return false;
+        bool ok = true;
+        for(auto const& part : parts){
+                for(size_t done=0;ok && done != part.size();){
+                        auto ret = ::write(fd, part.data() + done, part.size() - done);
+                        if( ret < 0 && errno == EINTR )
+                                continue;
+                        ok = ret > 0;
+                        if( ok )
+                                done += static_cast<size_t>(ret);
+                }
+        }
+        ok = ( ::close(fd) == 0 ) && ok;
+        if( ! ok || ::rename(tmp.c_str(), path.c_str()) != 0 ){
+                int saved = errno;
+                ::unlink(tmp.c_str());
+                errno = saved;
+                return false;
+        }
+        return true;
+}
+
+} // end namespace celf
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "celf/elf_file.h"
+
+#include <string>
+#include <boost/utility/string_view.hpp>
+
+namespace celf{
+
+enum ElfNT{
+        NT_GNU_BUILD_ID=3,
+};
+
+/*
+        Calls f(name, type, desc) for every note in a SHT_NOTE section or
+        PT_NOTE segment, stopping at the first malformed entry. Name and
+        descriptor are each padded to 4 bytes
+
+                n_namesz | n_descsz | n_type | name | desc
+ */
+template<class F>
+void ForEachNote(MemoryView mem, F const& f){
+        auto pad = [](size_t n){ return ( n + 3 ) & ~size_t{3}; };
+        for(size_t offset=0;mem.Contains(offset, sizeof(Elf64_Nhdr));){
+                auto nh = mem.Read<Elf64_Nhdr>(offset);
+                size_t name_offset = offset + sizeof(Elf64_Nhdr);
+                size_t desc_offset = name_offset + pad(nh.n_namesz);
+                if( ! mem.Contains(name_offset, pad(nh.n_namesz)) || ! mem.Contains(desc_offset, nh.n_descsz) )
+                        return;
+                boost::string_view name{mem.data() + name_offset, nh.n_namesz};
+                // the name is stored with its NUL
+                if( ! name.empty() && name.back() == '\0' )
+                        name.remove_suffix(1);
+                f(name, nh.n_type, mem.Slice(desc_offset, nh.n_descsz));
+                offset = desc_offset + pad(nh.n_descsz);
+        }
+}
+
+// raw bytes of the NT_GNU_BUILD_ID note among notes, if there is one
+inline bool FindBuildId(MemoryView notes, std::string& result){
+        bool found = false;
+        ForEachNote(notes, [&](boost::string_view name, Elf64_Word type, MemoryView desc){
+                if( ! found && type == NT_GNU_BUILD_ID && name == "GNU" ){
+                        result.assign(desc.data(), desc.size());
+                        found = true;
+                }
+        });
+        return found;
+}
+
+// lower case hex, the way build ids are usually written
+inline std::string HexBytes(boost::string_view bytes){
+        static const char digits[] = "0123456789abcdef";
+        std::string result(bytes.size() * 2, '0');
+        for(size_t i=0;i!=bytes.size();++i){
+                auto c = static_cast<unsigned char>(bytes[i]);
+                result[2 * i] = digits[c >> 4];
+                result[2 * i + 1] = digits[c & 0xf];
+        }
+        return result;
+}
+
+// raw bytes of the NT_GNU_BUILD_ID note, empty when there is none
+inline std::string BuildId(ElfFile const& elf){
+        std::string result;
+        for(auto const& sh : elf.section_headers){
+                if( sh.sh_type == SHT_NOTE && elf.memory.Contains(sh.sh_offset, sh.sh_size) &&
+                    FindBuildId(elf.memory.Slice(sh.sh_offset, sh.sh_size), result) )
+                        return result;
+        }
+        // stripped of section headers, the segments still have it
+        for(auto const& ph : elf.program_headers){
+                if( ph.p_type == PT_NOTE && elf.memory.Contains(ph.p_offset, ph.p_filesz) &&
+                    FindBuildId(elf.memory.Slice(ph.p_offset, ph.p_filesz), result) )
+                        return result;
+        }
+        return result;
+}
+
+} // end namespace celf
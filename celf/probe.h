@@ -0,0 +1,166 @@
+#pragma once
+
+#include "celf/elf_file.h"
+#include "celf/notes.h"
+#include "celf/json.h"
+#include "celf/stats.h"
+
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace celf{
+
+/*
+        What can be learned about a file from its first page, its header,
+        program header table and build id
+ */
+struct ProbeResult{
+        Elf64_Ehdr header;
+        std::vector<Elf64_Phdr> program_headers;
+        // raw bytes, empty when the file has no NT_GNU_BUILD_ID note
+        std::string build_id;
+        size_t file_size{0};
+};
+
+namespace probe_detail{
+
+// reads exactly size bytes at offset, short reads are retried
+inline bool ReadAt(int fd, void* buffer, size_t size, size_t offset){
+        auto ptr = static_cast<char*>(buffer);
+        while( size != 0 ){
+                auto ret = ::pread(fd, ptr, size, static_cast<off_t>(offset));
+                if( ret < 0 && errno == EINTR )
+                        continue;
+                if( ret <= 0 )
+                        return false;
+                ptr += ret;
+                offset += static_cast<size_t>(ret);
+                size -= static_cast<size_t>(ret);
+        }
+        return true;
+}
+
+struct Fd{
+        explicit Fd(int fd):fd{fd}{}
+        ~Fd(){
+                if( fd != -1 )
+                        ::close(fd);
+        }
+        Fd(Fd const&)=delete;
+        Fd& operator=(Fd const&)=delete;
+        int fd;
+};
+
+} // end namespace probe_detail
+
+/*
+        Reads the header, the program header table and the PT_NOTE
+        segments with positioned reads, without mapping or buffering the
+        file. Linkers put all three at the start, so one read of the
+        first page is usually all it takes, anything past it is read on
+        its own. Section headers are never looked at, which is what keeps
+        the cost per file to a few system calls when walking large trees
+ */
+class Prober{
+public:
+        using ResultType = boost::variant<
+                ProbeResult,
+                std::string,
+                NotElf
+        >;
+
+        // first read, covers the usual layout
+        static constexpr size_t HeadBytes = 4096;
+        // notes bigger than this aren't build ids
+        static constexpr size_t MaxNoteBytes = 64 * 1024;
+
+        ResultType ProbeFile(std::string const& filename){
+                StatsScope scope{stats, "probe", filename, 0};
+                probe_detail::Fd file{::open(filename.c_str(), O_RDONLY | O_CLOEXEC)};
+                if( file.fd == -1 )
+                        return "Unable to open " + filename + ": " + std::strerror(errno);
+                struct stat st;
+                if( ::fstat(file.fd, &st) != 0 )
+                        return "Unable to stat " + filename + ": " + std::strerror(errno);
+                if( ! S_ISREG(st.st_mode) )
+                        return "Not a regular file";
+
+                ProbeResult result;
+                result.file_size = static_cast<size_t>(st.st_size);
+                size_t head_size = result.file_size < HeadBytes ? result.file_size : HeadBytes;
+                if( ! probe_detail::ReadAt(file.fd, head_, head_size, 0) )
+                        return "Unable to read " + filename + ": " + std::strerror(errno);
+                MemoryView head{head_, head_size};
+
+                if( head.size() < 4 || std::memcmp(head.data(), "\x7f" "ELF", 4) != 0 )
+                        return NotElf{};
+                if( head.size() < sizeof(Elf64_Ehdr) )
+                        return "File too small for an ELF header";
+                auto& header = result.header;
+                header = head.Read<Elf64_Ehdr>(0);
+                if( header.e_ident[EI_CLASS] != ELFCLASS64 )
+                        return "Only ELFCLASS64 objects are supported";
+
+                if( header.e_phoff == 0 )
+                        return result;
+                size_t table_size = static_cast<size_t>(header.e_phnum) * header.e_phentsize;
+                if( header.e_phentsize < sizeof(Elf64_Phdr) ||
+                    header.e_phoff > result.file_size || table_size > result.file_size - header.e_phoff )
+                        return "Program header table out of range";
+                MemoryView table = Fetch(file.fd, head, header.e_phoff, table_size, table_);
+                if( table.size() != table_size )
+                        return "Unable to read " + filename + ": " + std::strerror(errno);
+                result.program_headers.reserve(header.e_phnum);
+                for(size_t i=0;i!=header.e_phnum;++i)
+                        result.program_headers.push_back(table.Read<Elf64_Phdr>(i * header.e_phentsize));
+
+                for(auto const& ph : result.program_headers){
+                        if( ph.p_type != PT_NOTE || ph.p_filesz > MaxNoteBytes ||
+                            ph.p_offset > result.file_size || ph.p_filesz > result.file_size - ph.p_offset )
+                                continue;
+                        MemoryView notes = Fetch(file.fd, head, ph.p_offset, ph.p_filesz, note_);
+                        if( notes.size() == ph.p_filesz && FindBuildId(notes, result.build_id) )
+                                break;
+                }
+                return result;
+        }
+
+        // records a probe phase for every file when set
+        Stats* stats{nullptr};
+private:
+        // [offset, offset + size) out of the first page, or read into
+        // storage, empty when the read fails
+        MemoryView Fetch(int fd, MemoryView head, size_t offset, size_t size, std::vector<char>& storage){
+                if( head.Contains(offset, size) )
+                        return head.Slice(offset, size);
+                storage.resize(size);
+                if( ! probe_detail::ReadAt(fd, storage.data(), size, offset) )
+                        return MemoryView{};
+                return MemoryView{storage.data(), size};
+        }
+
+        alignas(Elf64_Ehdr) char head_[HeadBytes];
+        // kept between files so a batch reuses them
+        std::vector<char> table_;
+        std::vector<char> note_;
+};
+
+// the header and program header records, then one with the build id
+inline void DisplayProbe(ProbeResult const& probe, JsonWriter& out){
+        out.BeginDocument();
+        DisplayHeader(probe.header, out);
+        for(size_t i=0;i!=probe.program_headers.size();++i)
+                DisplayProgramHeader(probe.program_headers[i], i, out);
+        out.BeginRecord("probe");
+        out.Field("file_size", probe.file_size);
+        out.Field("build_id", HexBytes(probe.build_id));
+        out.EndRecord();
+        out.EndDocument();
+}
+
+} // end namespace celf
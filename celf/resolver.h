@@ -0,0 +1,527 @@
+#pragma once
+
+#include "celf/elf_file.h"
+#include "celf/symbol_index.h"
+#include "celf/thread_pool.h"
+#include "celf/json.h"
+#include "celf/stats.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <boost/optional.hpp>
+#include <boost/utility/string_view.hpp>
+
+namespace celf{
+
+/*
+        What the dynamic section of a file says about loading it. The
+        names are views into its string table
+ */
+struct DynamicInfo{
+        std::vector<boost::string_view> needed;
+        boost::string_view soname;
+        // colon separated directory lists
+        boost::string_view rpath;
+        boost::string_view runpath;
+};
+
+inline DynamicInfo GetDynamicInfo(ElfFile const& elf){
+        DynamicInfo result;
+        for(auto const& section : elf.sections){
+                auto dynt = boost::get<DynamicTable>(&section);
+                if( ! dynt || dynt->Link() >= elf.sections.size() )
+                        continue;
+                auto strtab = boost::get<StringTable>(&elf.sections[dynt->Link()]);
+                if( ! strtab )
+                        continue;
+                auto name = [&](Elf64_Xword offset){
+                        if( offset >= strtab->Memory().size() )
+                                return boost::string_view{};
+                        return strtab->At(static_cast<Elf64_Word>(offset));
+                };
+                for(size_t idx=0;idx!=dynt->size();++idx){
+                        auto _ = (*dynt)[idx];
+                        switch(_.d_tag){
+                        case DT_NEEDED:
+                                result.needed.push_back(name(_.d_val));
+                                break;
+                        case DT_SONAME:
+                                result.soname = name(_.d_val);
+                                break;
+                        case DT_RPATH:
+                                result.rpath = name(_.d_val);
+                                break;
+                        case DT_RUNPATH:
+                                result.runpath = name(_.d_val);
+                                break;
+                        }
+                }
+                break;
+        }
+        return result;
+}
+
+/*
+        Gives every distinct name a dense id. Names are views into the
+        files and hashed by the caller, so hashing can be spread over
+        threads while the table itself is filled from one. Find is safe
+        to call concurrently once nothing is being added
+ */
+class NameInterner{
+public:
+        // room for n names without rehashing
+        void Reserve(size_t n){
+                size_t capacity = 16;
+                while( capacity < n * 2 )
+                        capacity *= 2;
+                if( capacity > slots_.size() )
+                        Rehash(capacity);
+                names_.reserve(n);
+        }
+        // id of name, a new one when it's not been seen
+        Elf64_Word Intern(boost::string_view name, std::uint32_t hash){
+                if( ( names_.size() + 1 ) * 2 > slots_.size() )
+                        Rehash(std::max<size_t>(16, slots_.size() * 2));
+                size_t pos = hash & mask_;
+                for(;; pos = ( pos + 1 ) & mask_){
+                        auto const& slot = slots_[pos];
+                        if( slot.entry == 0 )
+                                break;
+                        if( slot.hash == hash && names_[slot.entry - 1] == name )
+                                return slot.entry - 1;
+                }
+                names_.push_back(name);
+                slots_[pos] = Slot{hash, static_cast<Elf64_Word>(names_.size())};
+                return static_cast<Elf64_Word>(names_.size() - 1);
+        }
+        boost::optional<Elf64_Word> Find(boost::string_view name, std::uint32_t hash)const{
+                if( slots_.empty() )
+                        return boost::none;
+                for(size_t pos = hash & mask_;; pos = ( pos + 1 ) & mask_){
+                        auto const& slot = slots_[pos];
+                        if( slot.entry == 0 )
+                                return boost::none;
+                        if( slot.hash == hash && names_[slot.entry - 1] == name )
+                                return slot.entry - 1;
+                }
+        }
+
+        boost::string_view Name(Elf64_Word id)const{ return names_.at(id); }
+        size_t size()const{ return names_.size(); }
+private:
+        struct Slot{
+                std::uint32_t hash;
+                Elf64_Word entry; // one past the id, 0 is empty
+        };
+        void Rehash(size_t capacity){
+                std::vector<Slot> slots(capacity, Slot{0, 0});
+                mask_ = capacity - 1;
+                for(auto const& _ : slots_){
+                        if( _.entry == 0 )
+                                continue;
+                        size_t pos = _.hash & mask_;
+                        for(; slots[pos].entry != 0; pos = ( pos + 1 ) & mask_);
+                        slots[pos] = _;
+                }
+                slots_.swap(slots);
+        }
+
+        std::vector<Slot> slots_;
+        std::vector<boost::string_view> names_;
+        size_t mask_{0};
+};
+
+// one file of a DT_NEEDED closure
+struct LoadedObject{
+        std::string path;
+        // the DT_NEEDED name it was loaded for, empty for the first
+        std::string needed_as;
+        // the object that needed it first
+        boost::optional<size_t> parent;
+        ElfFilePtr elf;
+        DynamicInfo dynamic;
+        // section index of .dynsym
+        boost::optional<Elf64_Word> dynsym;
+};
+
+struct MissingLibrary{
+        std::string name;
+        size_t needed_by;
+};
+
+struct SymbolBinding{
+        // in the .dynsym of the object with the reference
+        Elf64_Word symbol;
+        bool weak;
+        // where it's defined, none when nothing in the closure defines it
+        boost::optional<Elf64_Word> object;
+        // in the .dynsym of that object
+        Elf64_Word definition{0};
+        // another object whose PLT entry for the name is its address,
+        // an undefined function with a value, which references other
+        // than calls bind to instead
+        boost::optional<Elf64_Word> canonical;
+};
+
+struct Resolution{
+        // in load order, breadth first from the file asked for
+        std::vector<LoadedObject> objects;
+        std::vector<MissingLibrary> missing;
+        // by object, every undefined symbol of its .dynsym
+        std::vector<std::vector<SymbolBinding> > bindings;
+        // every name defined anywhere in the closure
+        NameInterner names;
+};
+
+/*
+        Loads a file and the closure of its DT_NEEDED entries the way the
+        dynamic loader would, then binds each undefined .dynsym entry to
+        the first definition in load order.
+
+        A name without a slash is looked for in DT_RPATH of the objects
+        that led to it when the one needing it has no DT_RUNPATH, then
+        library_path, then DT_RUNPATH, then default_path. $ORIGIN is
+        expanded, ld.so.cache is not read, and files for another machine
+        are passed over. Each level of the breadth first walk is parsed in
+        parallel.
+
+        Symbol versions are not looked at, a reference binds to whichever
+        version of the name is found first
+ */
+struct SymbolResolver{
+        using ResultType = boost::variant<
+                Resolution,
+                std::string
+        >;
+
+        // searched between DT_RPATH and DT_RUNPATH, like LD_LIBRARY_PATH
+        std::vector<std::string> library_path;
+        // searched last, the usual contents of ld.so.conf
+        std::vector<std::string> default_path{
+                "/lib/x86_64-linux-gnu", "/usr/lib/x86_64-linux-gnu",
+                "/lib64", "/usr/lib64", "/lib", "/usr/lib",
+        };
+        // libraries are parsed and symbols hashed in parallel when set
+        ThreadPool* pool{nullptr};
+        Stats* stats{nullptr};
+
+        ResultType Resolve(std::string const& filename)const{
+                StatsScope scope{stats, "resolve", filename, 0};
+                Resolution result;
+                {
+                        ElfParser parser;
+                        parser.stats = stats;
+                        auto pret = parser.ParseFile(filename);
+                        if( ! boost::get<ElfFilePtr>(&pret) )
+                                return ErrorOf(pret);
+                        LoadedObject root;
+                        root.path = filename;
+                        root.elf = std::move(boost::get<ElfFilePtr>(pret));
+                        result.objects.push_back(std::move(root));
+                        Prepare(result.objects.back());
+                }
+                Load(result);
+                Bind(result);
+                return result;
+        }
+private:
+        void Prepare(LoadedObject& obj)const{
+                obj.dynamic = GetDynamicInfo(*obj.elf);
+                for(Elf64_Word idx=0;idx!=obj.elf->sections.size();++idx){
+                        auto symt = boost::get<SymbolTable>(&obj.elf->sections[idx]);
+                        if( symt && symt->IsDynamic() ){
+                                obj.dynsym = idx;
+                                break;
+                        }
+                }
+        }
+
+        static std::string DirName(std::string const& path){
+                auto pos = path.rfind('/');
+                if( pos == std::string::npos )
+                        return ".";
+                if( pos == 0 )
+                        return "/";
+                return path.substr(0, pos);
+        }
+        // list split on ':' with $ORIGIN replaced by the directory of obj
+        static void AddDirectories(boost::string_view list, LoadedObject const& obj, std::vector<std::string>& result){
+                while( ! list.empty() ){
+                        auto pos = list.find(':');
+                        auto dir = list.substr(0, pos).to_string();
+                        list = pos == boost::string_view::npos ? boost::string_view{} : list.substr(pos + 1);
+                        if( dir.empty() )
+                                continue;
+                        auto origin = DirName(obj.path);
+                        for(boost::string_view var : {"${ORIGIN}", "$ORIGIN"}){
+                                for(size_t at = dir.find(var.data()); at != std::string::npos;
+                                    at = dir.find(var.data(), at + origin.size()))
+                                        dir.replace(at, var.size(), origin);
+                        }
+                        result.push_back(std::move(dir));
+                }
+        }
+        // where to look for a DT_NEEDED name of objects[parent], in order
+        std::vector<std::string> Candidates(std::vector<LoadedObject> const& objects, size_t parent,
+                                            boost::string_view name)const{
+                std::vector<std::string> dirs;
+                auto const& obj = objects[parent];
+                if( name.find('/') != boost::string_view::npos ){
+                        AddDirectories(name, obj, dirs);
+                        return dirs;
+                }
+                if( obj.dynamic.runpath.empty() ){
+                        for(boost::optional<size_t> idx = parent; idx; idx = objects[*idx].parent)
+                                AddDirectories(objects[*idx].dynamic.rpath, objects[*idx], dirs);
+                }
+                dirs.insert(dirs.end(), library_path.begin(), library_path.end());
+                AddDirectories(obj.dynamic.runpath, obj, dirs);
+                dirs.insert(dirs.end(), default_path.begin(), default_path.end());
+                for(auto& _ : dirs)
+                        _ += "/" + name.to_string();
+                return dirs;
+        }
+
+        // parses the first candidate that is an ELF file for machine
+        boost::optional<LoadedObject> Locate(std::vector<std::string> const& candidates, Elf64_Half machine)const{
+                ElfParser parser;
+                parser.stats = stats;
+                for(auto const& path : candidates){
+                        auto pret = parser.ParseFile(path);
+                        auto ptr = boost::get<ElfFilePtr>(&pret);
+                        if( ! ptr || (*ptr)->header.e_machine != machine )
+                                continue;
+                        LoadedObject result;
+                        result.path = path;
+                        result.elf = std::move(*ptr);
+                        Prepare(result);
+                        return result;
+                }
+                return boost::none;
+        }
+
+        void Load(Resolution& result)const{
+                auto& objects = result.objects;
+                auto machine = objects.front().elf->header.e_machine;
+                // DT_NEEDED names and sonames already loaded
+                std::map<std::string, size_t> loaded;
+                auto add_names = [&](size_t idx){
+                        auto const& obj = objects[idx];
+                        if( ! obj.dynamic.soname.empty() )
+                                loaded.emplace(obj.dynamic.soname.to_string(), idx);
+                        if( ! obj.needed_as.empty() )
+                                loaded.emplace(obj.needed_as, idx);
+                };
+                add_names(0);
+
+                struct Request{
+                        std::string name;
+                        size_t parent;
+                        std::vector<std::string> candidates;
+                        boost::optional<LoadedObject> found;
+                };
+                for(size_t first=0, last=objects.size();first != last;first = last, last = objects.size()){
+                        StatsScope scope{stats, "resolve.load", last - first};
+                        std::vector<Request> requests;
+                        std::map<std::string, size_t> requested;
+                        for(size_t idx=first;idx!=last;++idx){
+                                for(auto name : objects[idx].dynamic.needed){
+                                        auto key = name.to_string();
+                                        if( name.empty() || loaded.count(key) || requested.count(key) )
+                                                continue;
+                                        requested.emplace(key, requests.size());
+                                        requests.push_back(Request{key, idx, Candidates(objects, idx, name), boost::none});
+                                }
+                        }
+                        {
+                                TaskGroup group{pool};
+                                for(auto& _ : requests)
+                                        group.Run([this, &_, machine](){ _.found = Locate(_.candidates, machine); });
+                                group.Wait();
+                        }
+                        for(auto& _ : requests){
+                                if( ! _.found ){
+                                        result.missing.push_back(MissingLibrary{_.name, _.parent});
+                                        continue;
+                                }
+                                // the same file under another name
+                                auto same = std::find_if(objects.begin(), objects.end(), [&](LoadedObject const& obj){
+                                        return obj.elf->identity.device == _.found->elf->identity.device &&
+                                               obj.elf->identity.inode == _.found->elf->identity.inode;
+                                });
+                                if( same != objects.end() ){
+                                        loaded.emplace(_.name, same - objects.begin());
+                                        continue;
+                                }
+                                _.found->needed_as = _.name;
+                                _.found->parent = _.parent;
+                                objects.push_back(std::move(*_.found));
+                                add_names(objects.size() - 1);
+                        }
+                }
+        }
+
+        struct Entry{
+                boost::string_view name;
+                std::uint32_t hash;
+                Elf64_Word index;
+                bool weak;
+        };
+        struct Symbols{
+                std::vector<Entry> defined;
+                std::vector<Entry> undefined;
+                // undefined functions with a PLT address
+                std::vector<Entry> canonical;
+        };
+        // the exported definitions and undefined references of obj
+        static void Collect(LoadedObject const& obj, Symbols& result){
+                if( ! obj.dynsym )
+                        return;
+                auto const& elf = *obj.elf;
+                auto const& symt = boost::get<SymbolTable>(elf.sections[*obj.dynsym]);
+                auto strtab = symt.Link() < elf.sections.size()
+                        ? boost::get<StringTable>(&elf.sections[symt.Link()]) : nullptr;
+                if( ! strtab )
+                        return;
+                for(size_t idx=1;idx<symt.size();++idx){
+                        auto sym = symt[idx];
+                        if( sym.st_name == 0 || sym.st_name >= strtab->Memory().size() || sym.Binding() == STB_LOCAL )
+                                continue;
+                        // hidden and internal symbols are never exported
+                        auto visibility = sym.st_other & 0x3;
+                        if( sym.IsDefined() && ( visibility == 1 || visibility == 2 ) )
+                                continue;
+                        auto name = strtab->At(sym.st_name);
+                        Entry e{name, GnuHash(name), static_cast<Elf64_Word>(idx), sym.Binding() == STB_WEAK};
+                        if( sym.IsDefined() ){
+                                result.defined.push_back(e);
+                                continue;
+                        }
+                        result.undefined.push_back(e);
+                        if( sym.Type() == STT_FUNC && ToXword(sym.st_value) != 0 )
+                                result.canonical.push_back(e);
+                }
+        }
+
+        void Bind(Resolution& result)const{
+                auto const& objects = result.objects;
+                std::vector<Symbols> symbols(objects.size());
+                {
+                        StatsScope scope{stats, "resolve.collect", objects.size()};
+                        TaskGroup group{pool};
+                        for(size_t idx=0;idx!=objects.size();++idx)
+                                group.Run([&objects, &symbols, idx](){ Collect(objects[idx], symbols[idx]); });
+                        group.Wait();
+                }
+
+                // first definition of each name in load order, by name id
+                std::vector<std::pair<Elf64_Word, Elf64_Word> > definitions;
+                std::map<Elf64_Word, Elf64_Word> canonical;
+                {
+                        size_t total = 0;
+                        for(auto const& _ : symbols)
+                                total += _.defined.size();
+                        StatsScope scope{stats, "resolve.intern", total};
+                        result.names.Reserve(total);
+                        definitions.reserve(total);
+                        for(size_t idx=0;idx!=objects.size();++idx){
+                                for(auto const& _ : symbols[idx].defined){
+                                        auto id = result.names.Intern(_.name, _.hash);
+                                        if( id == definitions.size() )
+                                                definitions.emplace_back(static_cast<Elf64_Word>(idx), _.index);
+                                }
+                        }
+                        // a handful, nearly always from the executable
+                        for(size_t idx=0;idx!=objects.size();++idx){
+                                for(auto const& _ : symbols[idx].canonical){
+                                        if( auto id = result.names.Find(_.name, _.hash) )
+                                                canonical.emplace(*id, static_cast<Elf64_Word>(idx));
+                                }
+                        }
+                }
+
+                StatsScope scope{stats, "resolve.bind", objects.size()};
+                result.bindings.resize(objects.size());
+                TaskGroup group{pool};
+                for(size_t idx=0;idx!=objects.size();++idx){
+                        group.Run([&result, &symbols, &definitions, &canonical, idx](){
+                                auto& bindings = result.bindings[idx];
+                                bindings.reserve(symbols[idx].undefined.size());
+                                for(auto const& _ : symbols[idx].undefined){
+                                        SymbolBinding binding{_.index, _.weak, boost::none, 0, boost::none};
+                                        if( auto id = result.names.Find(_.name, _.hash) ){
+                                                binding.object = definitions[*id].first;
+                                                binding.definition = definitions[*id].second;
+                                                auto iter = canonical.find(*id);
+                                                if( iter != canonical.end() && iter->second != idx )
+                                                        binding.canonical = iter->second;
+                                        }
+                                        bindings.push_back(binding);
+                                }
+                        });
+                }
+                group.Wait();
+        }
+};
+
+/*
+        An "object" record for every file of the closure, a "missing" one
+        for every DT_NEEDED name that wasn't found, a "binding" one for
+        every undefined symbol, then a "resolution" record with the totals
+ */
+inline void DisplayResolution(Resolution const& res, JsonWriter& out){
+        out.BeginDocument();
+        for(size_t i=0;i!=res.objects.size();++i){
+                auto const& obj = res.objects[i];
+                out.BeginRecord("object");
+                out.Field("index", i);
+                out.Field("path", obj.path);
+                if( ! obj.needed_as.empty() )
+                        out.Field("needed_as", obj.needed_as);
+                if( ! obj.dynamic.soname.empty() )
+                        out.Field("soname", obj.dynamic.soname);
+                if( obj.parent )
+                        out.Field("parent", *obj.parent);
+                out.EndRecord();
+        }
+        for(auto const& _ : res.missing){
+                out.BeginRecord("missing");
+                out.Field("name", _.name);
+                out.Field("needed_by", _.needed_by);
+                out.EndRecord();
+        }
+        size_t undefined = 0;
+        size_t unbound = 0;
+        for(size_t i=0;i!=res.objects.size();++i){
+                auto const& obj = res.objects[i];
+                for(auto const& _ : res.bindings[i]){
+                        auto const& symt = boost::get<SymbolTable>(obj.elf->sections[*obj.dynsym]);
+                        out.BeginRecord("binding");
+                        out.Field("object", i);
+                        out.Field("symbol", _.symbol);
+                        out.Field("sym_name", obj.elf->LookupName(symt.Link(), symt[_.symbol].st_name));
+                        out.Field("weak", (int)_.weak);
+                        if( _.object ){
+                                out.Field("defined_in", *_.object);
+                                out.Field("definition", _.definition);
+                        }
+                        if( _.canonical )
+                                out.Field("canonical", *_.canonical);
+                        out.EndRecord();
+                        ++undefined;
+                        if( ! _.object )
+                                ++unbound;
+                }
+        }
+        out.BeginRecord("resolution");
+        out.Field("objects", res.objects.size());
+        out.Field("missing", res.missing.size());
+        out.Field("names", res.names.size());
+        out.Field("undefined", undefined);
+        out.Field("unbound", unbound);
+        out.EndRecord();
+        out.EndDocument();
+}
+
+} // end namespace celf
@@ -0,0 +1,425 @@
+#pragma once
+
+#include "celf/elf_file.h"
+#include "celf/symbol_index.h"
+#include "celf/address.h"
+#include "celf/json.h"
+
+#include <string>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <sstream>
+#include <unordered_map>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace celf{
+
+/*
+        Parsed files by path, least recently used first out once they go
+        over max_bytes. An entry counts its mapped bytes, plus the symbol
+        index and address translator once Account is told they were
+        built, since those stay with the file. Every Get stats the path and
+        reparses when the device, inode, size or mtime changed, so a
+        rebuilt binary is never answered from the old mapping. Entries
+        are shared, one evicted while in use stays alive until released
+ */
+class FileCache{
+public:
+        using ResultType = boost::variant<
+               std::shared_ptr<const ElfFile>,
+               std::string
+        >;
+
+        explicit FileCache(size_t max_bytes):max_bytes_{max_bytes}{}
+
+        ResultType Get(std::string const& path){
+                struct stat st;
+                if( ::stat(path.c_str(), &st) != 0 )
+                        return "Unable to stat " + path + ": " + std::strerror(errno);
+                auto identity = FileIdentity::Of(st);
+                {
+                        std::lock_guard<std::mutex> lock(mtx_);
+                        auto iter = map_.find(path);
+                        if( iter != map_.end() ){
+                                if( iter->second->elf->identity == identity ){
+                                        lru_.splice(lru_.begin(), lru_, iter->second);
+                                        ++hits_;
+                                        return iter->second->elf;
+                                }
+                                ++stale_;
+                                Erase(iter->second);
+                        }
+                        ++misses_;
+                }
+                // parsed outside the lock, two clients asking for the same
+                // new file both parse it and the second one wins
+                auto pret = ElfParser{}.ParseFile(path, MapAdvice::Random);
+                if( ! boost::get<ElfFilePtr>(&pret) )
+                        return ErrorOf(pret);
+                std::shared_ptr<const ElfFile> elf = std::move(boost::get<ElfFilePtr>(pret));
+
+                std::lock_guard<std::mutex> lock(mtx_);
+                auto iter = map_.find(path);
+                if( iter != map_.end() )
+                        Erase(iter->second);
+                lru_.push_front(Entry{path, elf, elf->memory.size()});
+                map_[path] = lru_.begin();
+                bytes_ += elf->memory.size();
+                Trim();
+                return elf;
+        }
+        // counts the heap an entry's file built after Get, a no-op when
+        // the entry has been replaced or evicted since
+        void Account(std::string const& path, ElfFile const& elf, SymbolIndex const& index){
+                Account(path, elf, &Entry::index_bytes, index.HeapBytes());
+        }
+        void Account(std::string const& path, ElfFile const& elf, AddressTranslator const& translator){
+                Account(path, elf, &Entry::translator_bytes, translator.HeapBytes());
+        }
+
+        void Describe(JsonWriter& out)const{
+                std::lock_guard<std::mutex> lock(mtx_);
+                out.BeginRecord("cache");
+                out.Field("entries", lru_.size());
+                out.Field("bytes", bytes_);
+                out.Field("max_bytes", max_bytes_);
+                out.Field("hits", hits_);
+                out.Field("misses", misses_);
+                out.Field("stale", stale_);
+                out.EndRecord();
+        }
+private:
+        struct Entry{
+                std::string path;
+                std::shared_ptr<const ElfFile> elf;
+                size_t bytes;
+                size_t index_bytes{0};
+                size_t translator_bytes{0};
+        };
+        void Account(std::string const& path, ElfFile const& elf, size_t Entry::* field, size_t bytes){
+                std::lock_guard<std::mutex> lock(mtx_);
+                auto iter = map_.find(path);
+                if( iter == map_.end() || iter->second->elf.get() != &elf )
+                        return;
+                auto& entry = *iter->second;
+                entry.bytes = entry.bytes - entry.*field + bytes;
+                bytes_ = bytes_ - entry.*field + bytes;
+                entry.*field = bytes;
+                Trim();
+        }
+        // the newest entry stays even when it alone is over
+        void Trim(){
+                while( bytes_ > max_bytes_ && lru_.size() > 1 )
+                        Erase(std::prev(lru_.end()));
+        }
+        void Erase(std::list<Entry>::iterator iter){
+                bytes_ -= iter->bytes;
+                map_.erase(iter->path);
+                lru_.erase(iter);
+        }
+
+        size_t max_bytes_;
+        mutable std::mutex mtx_;
+        std::list<Entry> lru_;
+        std::unordered_map<std::string, std::list<Entry>::iterator> map_;
+        size_t bytes_{0};
+        size_t hits_{0};
+        size_t misses_{0};
+        size_t stale_{0};
+};
+
+/*
+        Answers one request line, fields separated by spaces
+
+                header FILE
+                sections FILE
+                segments FILE
+                lookup FILE NAME|0xADDRESS...
+                translate FILE ADDRESS...
+                cache
+                quit
+
+        with NDJSON records, always followed by an end record carrying
+        the request number and status, so a client can pipeline a batch
+        of requests and match up the answers. Returns false on quit
+ */
+inline bool HandleRequest(FileCache& cache, boost::string_view line, size_t request, OutputBuffer& buffer){
+        std::vector<std::string> fields;
+        {
+                std::istringstream is{line.to_string()};
+                for(std::string field; is >> field;)
+                        fields.push_back(std::move(field));
+        }
+        std::string error;
+        bool keep_going = true;
+        try{
+                auto command = fields.empty() ? std::string{} : fields[0];
+                if( command == "quit" ){
+                        keep_going = false;
+                } else if( command == "cache" ){
+                        JsonWriter out{buffer, JsonStyle::Lines};
+                        cache.Describe(out);
+                } else if( command == "header" || command == "sections" ||
+                           command == "segments" || command == "lookup" || command == "translate" ){
+                        if( fields.size() < 2 )
+                                throw std::domain_error(command + " needs a file");
+                        auto ret = cache.Get(fields[1]);
+                        if( auto ptr = boost::get<std::string>(&ret) )
+                                throw std::domain_error(*ptr);
+                        auto const& elf = *boost::get<std::shared_ptr<const ElfFile> >(ret);
+                        JsonWriter out{buffer, JsonStyle::Lines};
+                        out.SetFile(fields[1]);
+                        if( command == "header" ){
+                                DisplayHeader(elf, out);
+                        } else if( command == "sections" ){
+                                for(size_t i=0;i!=elf.section_headers.size();++i){
+                                        out.BeginRecord("section_headers");
+                                        DisplaySectionHeader(elf, i, out);
+                                        out.EndRecord();
+                                }
+                        } else if( command == "segments" ){
+                                for(size_t i=0;i!=elf.program_headers.size();++i)
+                                        DisplayProgramHeader(elf, i, out);
+                        } else if( command == "translate" ){
+                                std::vector<Elf64_Xword> addresses;
+                                for(size_t i=2;i<fields.size();++i){
+                                        char* end = nullptr;
+                                        addresses.push_back(std::strtoull(fields[i].c_str(), &end, 0));
+                                        if( *end != '\0' )
+                                                throw std::domain_error("bad address " + fields[i]);
+                                }
+                                auto const& translator = elf.Addresses();
+                                cache.Account(fields[1], elf, translator);
+                                for(auto const& _ : translator.Translate(addresses))
+                                        DisplayTranslation(elf, _, out);
+                        } else {
+                                auto const& index = elf.Symbols();
+                                cache.Account(fields[1], elf, index);
+                                for(size_t i=2;i<fields.size();++i)
+                                        DisplayLookup(elf, index, fields[i], out);
+                        }
+                } else {
+                        throw std::domain_error("unknown request " + command);
+                }
+        } catch(std::exception const& e){
+                error = e.what();
+        }
+        JsonWriter out{buffer, JsonStyle::Lines};
+        if( ! error.empty() ){
+                out.BeginRecord("error");
+                out.Field("message", error);
+                out.EndRecord();
+        }
+        out.BeginRecord("end");
+        out.Field("request", request);
+        out.Field("status", error.empty() ? "ok" : "error");
+        out.EndRecord();
+        return keep_going;
+}
+
+/*
+        Long running server on a Unix socket, so tools that ask many
+        small questions about the same binaries skip the process start
+        and the parse. Every connection gets its own thread and its
+        requests are answered in order, the answers to a pipelined batch
+        are written together.
+ */
+class QueryServer{
+public:
+        QueryServer(std::string socket_path, size_t cache_bytes)
+                :socket_path_{std::move(socket_path)}, cache_{cache_bytes}
+        {}
+        ~QueryServer(){
+                Stop();
+                Join();
+        }
+        QueryServer(QueryServer const&)=delete;
+        QueryServer& operator=(QueryServer const&)=delete;
+
+        // serves until Stop, returns why it couldn't start otherwise
+        std::string Run(){
+                // a client that goes away mid answer is a failed write,
+                // not the end of the server
+                std::signal(SIGPIPE, SIG_IGN);
+                sockaddr_un addr{};
+                addr.sun_family = AF_UNIX;
+                if( socket_path_.size() >= sizeof(addr.sun_path) )
+                        return "Socket path too long: " + socket_path_;
+                std::memcpy(addr.sun_path, socket_path_.c_str(), socket_path_.size() + 1);
+                int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+                if( fd == -1 )
+                        return std::string{"Unable to create socket: "} + std::strerror(errno);
+                auto error = RemoveStaleSocket(addr);
+                if( ! error.empty() ){
+                        ::close(fd);
+                        return error;
+                }
+                struct stat st;
+                if( ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+                    ::listen(fd, 64) != 0 || ::lstat(socket_path_.c_str(), &st) != 0 ){
+                        std::string msg = "Unable to listen on " + socket_path_ + ": " + std::strerror(errno);
+                        ::close(fd);
+                        return msg;
+                }
+                bool stopped;
+                {
+                        // a Stop before this finds no descriptor to shut
+                        // down, so it has to be seen here instead
+                        std::lock_guard<std::mutex> lock(mtx_);
+                        stopped = stop_;
+                        if( ! stopped )
+                                listen_fd_ = fd;
+                }
+                while( ! stopped && ! stop_ ){
+                        int conn = ::accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+                        if( conn == -1 ){
+                                if( errno == EINTR || errno == ECONNABORTED )
+                                        continue;
+                                break;
+                        }
+                        std::lock_guard<std::mutex> lock(mtx_);
+                        // Stop has already shut the others down
+                        if( stop_ ){
+                                ::close(conn);
+                                break;
+                        }
+                        Reap();
+                        auto conn_ptr = std::make_shared<Connection>();
+                        conn_ptr->fd = conn;
+                        conn_ptr->thread = std::thread([this, conn_ptr](){
+                                Serve(conn_ptr->fd);
+                                conn_ptr->done = true;
+                        });
+                        connections_.push_back(conn_ptr);
+                }
+                {
+                        // so Stop can't shut down a reused descriptor
+                        std::lock_guard<std::mutex> lock(mtx_);
+                        listen_fd_ = -1;
+                }
+                ::close(fd);
+                // unless another server has taken the path over since
+                struct stat now;
+                if( ::lstat(socket_path_.c_str(), &now) == 0 && now.st_dev == st.st_dev && now.st_ino == st.st_ino )
+                        ::unlink(socket_path_.c_str());
+                return std::string{};
+        }
+        // wakes Run and every connection up, safe from another thread.
+        // A connection's descriptor is only closed once its thread is
+        // joined, so it can't be reused under Stop
+        void Stop(){
+                stop_ = true;
+                std::lock_guard<std::mutex> lock(mtx_);
+                if( listen_fd_ != -1 )
+                        ::shutdown(listen_fd_, SHUT_RDWR);
+                for(auto const& _ : connections_){
+                        if( ! _->done )
+                                ::shutdown(_->fd, SHUT_RDWR);
+                }
+        }
+private:
+        struct Connection{
+                int fd;
+                std::thread thread;
+                std::atomic<bool> done{false};
+        };
+
+        // a socket left behind by a server that was killed is removed,
+        // anything else at the path is an error rather than deleted
+        std::string RemoveStaleSocket(sockaddr_un const& addr)const{
+                struct stat st;
+                if( ::lstat(socket_path_.c_str(), &st) != 0 ){
+                        if( errno == ENOENT )
+                                return std::string{};
+                        return "Unable to stat " + socket_path_ + ": " + std::strerror(errno);
+                }
+                if( ! S_ISSOCK(st.st_mode) )
+                        return socket_path_ + " exists and is not a socket";
+                int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+                if( fd == -1 )
+                        return std::string{"Unable to create socket: "} + std::strerror(errno);
+                int ret = ::connect(fd, reinterpret_cast<sockaddr const*>(&addr), sizeof(addr));
+                int err = errno;
+                ::close(fd);
+                if( ret == 0 )
+                        return "Another server is listening on " + socket_path_;
+                if( err != ECONNREFUSED )
+                        return "Unable to check " + socket_path_ + ": " + std::strerror(err);
+                if( ::unlink(socket_path_.c_str()) != 0 && errno != ENOENT )
+                        return "Unable to remove " + socket_path_ + ": " + std::strerror(errno);
+                return std::string{};
+        }
+
+        void Serve(int fd){
+                OutputBuffer buffer{fd};
+                std::string pending;
+                std::vector<char> chunk(64 * 1024);
+                size_t request = 0;
+                try{
+                        for(bool open = true; open;){
+                                auto ret = ::read(fd, chunk.data(), chunk.size());
+                                if( ret < 0 && errno == EINTR )
+                                        continue;
+                                if( ret <= 0 )
+                                        break;
+                                pending.append(chunk.data(), static_cast<size_t>(ret));
+                                size_t first = 0;
+                                for(size_t nl; open && ( nl = pending.find('\n', first) ) != std::string::npos; first = nl + 1)
+                                        open = HandleRequest(cache_, boost::string_view{pending}.substr(first, nl - first),
+                                                             ++request, buffer);
+                                pending.erase(0, first);
+                                if( pending.size() > MaxLine ){
+                                        JsonWriter out{buffer, JsonStyle::Lines};
+                                        out.BeginRecord("error");
+                                        out.Field("message", "request line too long");
+                                        out.EndRecord();
+                                        open = false;
+                                }
+                                buffer.Flush();
+                        }
+                } catch(std::exception const&){
+                        // the client went away
+                }
+                // the client sees the end of the answers now, the
+                // descriptor itself is closed when the thread is reaped
+                ::shutdown(fd, SHUT_RDWR);
+        }
+        // with mtx_ held
+        void Reap(){
+                for(auto iter = connections_.begin(); iter != connections_.end();){
+                        if( (*iter)->done ){
+                                (*iter)->thread.join();
+                                ::close((*iter)->fd);
+                                iter = connections_.erase(iter);
+                        } else {
+                                ++iter;
+                        }
+                }
+        }
+        void Join(){
+                std::lock_guard<std::mutex> lock(mtx_);
+                for(auto const& _ : connections_){
+                        _->thread.join();
+                        ::close(_->fd);
+                }
+                connections_.clear();
+        }
+
+        static constexpr size_t MaxLine = 1 << 20;
+
+        std::string socket_path_;
+        FileCache cache_;
+        std::atomic<bool> stop_{false};
+        std::mutex mtx_;
+        int listen_fd_{-1};
+        std::list<std::shared_ptr<Connection> > connections_;
+};
+
+} // end namespace celf
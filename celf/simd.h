@@ -0,0 +1,242 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) && ( defined(__GNUC__) || defined(__clang__) )
+#define CELF_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+namespace celf{
+namespace simd{
+
+/*
+        Byte scanning kernels over string tables. Every kernel has a scalar
+        version, SSE2 is always there on x86-64 and AVX2 is picked at
+        runtime. CELF_SIMD=scalar|sse2|avx2 in the environment forces one,
+        which is mostly useful to compare them
+ */
+enum class Isa{
+        Scalar,
+        SSE2,
+        AVX2,
+};
+
+inline Isa DetectIsa(){
+        static const Isa isa = [](){
+                Isa best = Isa::Scalar;
+#ifdef CELF_SIMD_X86
+                best = Isa::SSE2;
+                if( __builtin_cpu_supports("avx2") )
+                        best = Isa::AVX2;
+#endif
+                const char* env = std::getenv("CELF_SIMD");
+                if( env == nullptr )
+                        return best;
+                if( std::strcmp(env, "scalar") == 0 )
+                        return Isa::Scalar;
+                if( std::strcmp(env, "sse2") == 0 && best != Isa::Scalar )
+                        return Isa::SSE2;
+                return best;
+        }();
+        return isa;
+}
+
+inline const char* IsaName(Isa isa){
+        switch(isa){
+        case Isa::Scalar: return "scalar";
+        case Isa::SSE2:   return "sse2";
+        case Isa::AVX2:   return "avx2";
+        }
+        return "scalar";
+}
+
+namespace detail{
+
+// the C library's memchr is vectorized on most targets already, so the
+// fallback leans on it rather than on a byte loop
+inline size_t CountZerosScalar(const char* data, size_t first, size_t last){
+        size_t count = 0;
+        for(auto ptr = data + first, end = data + last;
+            ( ptr = static_cast<const char*>(std::memchr(ptr, '\0', static_cast<size_t>(end - ptr))) ); ++ptr)
+                ++count;
+        return count;
+}
+inline std::uint32_t* WriteStartsScalar(const char* data, size_t first, size_t last, std::uint32_t* out){
+        for(auto ptr = data + first, end = data + last;
+            ( ptr = static_cast<const char*>(std::memchr(ptr, '\0', static_cast<size_t>(end - ptr))) ); ++ptr)
+                *out++ = static_cast<std::uint32_t>(ptr - data + 1);
+        return out;
+}
+
+inline const char* FindScalar(const char* first, const char* last, const char* needle, size_t n){
+        auto ptr = static_cast<const char*>(::memmem(first, static_cast<size_t>(last - first), needle, n));
+        return ptr ? ptr : last;
+}
+
+#ifdef CELF_SIMD_X86
+
+// writes the offset of every set bit, lowest first, and returns the end
+inline std::uint32_t* WriteBits(std::uint64_t mask, size_t base, std::uint32_t* out){
+        while( mask ){
+                *out++ = static_cast<std::uint32_t>(base + __builtin_ctzll(mask));
+                mask &= mask - 1;
+        }
+        return out;
+}
+
+// one bit per byte of a 64 byte block
+inline std::uint64_t ZeroMaskSSE2(const char* ptr){
+        const __m128i zero = _mm_setzero_si128();
+        std::uint64_t mask = 0;
+        for(int k=0;k!=4;++k){
+                auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + 16 * k));
+                mask |= static_cast<std::uint64_t>(static_cast<std::uint32_t>(
+                        _mm_movemask_epi8(_mm_cmpeq_epi8(block, zero)))) << ( 16 * k );
+        }
+        return mask;
+}
+inline size_t CountZerosSSE2(const char* data, size_t first, size_t last){
+        size_t count = 0;
+        size_t i = first;
+        for(;i + 64 <= last;i += 64)
+                count += __builtin_popcountll(ZeroMaskSSE2(data + i));
+        return count + CountZerosScalar(data, i, last);
+}
+inline std::uint32_t* WriteStartsSSE2(const char* data, size_t first, size_t last, std::uint32_t* out){
+        size_t i = first;
+        for(;i + 64 <= last;i += 64)
+                out = WriteBits(ZeroMaskSSE2(data + i), i + 1, out);
+        return WriteStartsScalar(data, i, last, out);
+}
+
+__attribute__((target("avx2")))
+inline std::uint64_t ZeroMaskAVX2(const char* ptr){
+        const __m256i zero = _mm256_setzero_si256();
+        auto lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr));
+        auto hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr + 32));
+        auto mlo = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, zero)));
+        auto mhi = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, zero)));
+        return ( static_cast<std::uint64_t>(mhi) << 32 ) | mlo;
+}
+__attribute__((target("avx2,popcnt")))
+inline size_t CountZerosAVX2(const char* data, size_t first, size_t last){
+        size_t count = 0;
+        size_t i = first;
+        for(;i + 64 <= last;i += 64)
+                count += __builtin_popcountll(ZeroMaskAVX2(data + i));
+        return count + CountZerosScalar(data, i, last);
+}
+__attribute__((target("avx2,bmi")))
+inline std::uint32_t* WriteStartsAVX2(const char* data, size_t first, size_t last, std::uint32_t* out){
+        size_t i = first;
+        for(;i + 64 <= last;i += 64)
+                out = WriteBits(ZeroMaskAVX2(data + i), i + 1, out);
+        return WriteStartsScalar(data, i, last, out);
+}
+
+/*
+        Compares the first and last byte of the needle at every position
+        of a block and only runs memcmp where both match, see
+        http://0x80.pl/articles/simd-strfind.html
+ */
+inline const char* FindSSE2(const char* first, const char* last, const char* needle, size_t n){
+        if( n < 2 )
+                return FindScalar(first, last, needle, n);
+        const __m128i head = _mm_set1_epi8(needle[0]);
+        const __m128i tail = _mm_set1_epi8(needle[n-1]);
+        const char* ptr = first;
+        for(;ptr + n - 1 + 16 <= last;ptr += 16){
+                auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+                auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + n - 1));
+                auto mask = static_cast<std::uint32_t>(_mm_movemask_epi8(
+                        _mm_and_si128(_mm_cmpeq_epi8(a, head), _mm_cmpeq_epi8(b, tail))));
+                while( mask ){
+                        auto pos = ptr + __builtin_ctz(mask);
+                        if( std::memcmp(pos + 1, needle + 1, n - 2) == 0 )
+                                return pos;
+                        mask &= mask - 1;
+                }
+        }
+        return FindScalar(ptr, last, needle, n);
+}
+
+__attribute__((target("avx2")))
+inline const char* FindAVX2(const char* first, const char* last, const char* needle, size_t n){
+        if( n < 2 )
+                return FindScalar(first, last, needle, n);
+        const __m256i head = _mm256_set1_epi8(needle[0]);
+        const __m256i tail = _mm256_set1_epi8(needle[n-1]);
+        const char* ptr = first;
+        for(;ptr + n - 1 + 32 <= last;ptr += 32){
+                auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr));
+                auto b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr + n - 1));
+                auto mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(
+                        _mm256_and_si256(_mm256_cmpeq_epi8(a, head), _mm256_cmpeq_epi8(b, tail))));
+                while( mask ){
+                        auto pos = ptr + __builtin_ctz(mask);
+                        if( std::memcmp(pos + 1, needle + 1, n - 2) == 0 )
+                                return pos;
+                        mask &= mask - 1;
+                }
+        }
+        return FindSSE2(ptr, last, needle, n);
+}
+
+#endif // CELF_SIMD_X86
+
+} // end namespace detail
+
+// appends i + 1 for every NUL at data[i], first <= i < last. The range
+// is counted first and written in place, so it should be small enough to
+// still be in cache the second time round
+inline void EntryStarts(const char* data, size_t first, size_t last, std::vector<std::uint32_t>& out){
+        auto isa = DetectIsa();
+        if( isa == Isa::Scalar ){
+                // one memchr per entry, counting first would scan twice
+                for(auto ptr = data + first, end = data + last;
+                    ( ptr = static_cast<const char*>(std::memchr(ptr, '\0', static_cast<size_t>(end - ptr))) ); ++ptr)
+                        out.push_back(static_cast<std::uint32_t>(ptr - data + 1));
+                return;
+        }
+        size_t count = 0;
+        switch(isa){
+#ifdef CELF_SIMD_X86
+        case Isa::AVX2: count = detail::CountZerosAVX2(data, first, last); break;
+        case Isa::SSE2: count = detail::CountZerosSSE2(data, first, last); break;
+#endif
+        default: break;
+        }
+        size_t size = out.size();
+        out.resize(size + count);
+        auto ptr = out.data() + size;
+        switch(isa){
+#ifdef CELF_SIMD_X86
+        case Isa::AVX2: detail::WriteStartsAVX2(data, first, last, ptr); break;
+        case Isa::SSE2: detail::WriteStartsSSE2(data, first, last, ptr); break;
+#endif
+        default: break;
+        }
+}
+
+// first occurrence of the n byte needle in [first, last), or last
+inline const char* Find(const char* first, const char* last, const char* needle, size_t n){
+        if( n == 0 )
+                return first;
+        if( static_cast<size_t>(last - first) < n )
+                return last;
+#ifdef CELF_SIMD_X86
+        switch(DetectIsa()){
+        case Isa::AVX2: return detail::FindAVX2(first, last, needle, n);
+        case Isa::SSE2: return detail::FindSSE2(first, last, needle, n);
+        case Isa::Scalar: break;
+        }
+#endif
+        return detail::FindScalar(first, last, needle, n);
+}
+
+} // end namespace simd
+} // end namespace celf
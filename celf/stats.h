@@ -0,0 +1,157 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <boost/optional.hpp>
+#include <boost/timer/timer.hpp>
+#include <boost/utility/string_view.hpp>
+
+namespace celf{
+
+/*
+        Process wide heap counters. They only move when the program
+        includes celf/count_allocations.h, which replaces operator new, and
+        only while a Stats object exists
+ */
+struct AllocationCounters{
+        std::atomic<bool> enabled{false};
+        std::atomic<size_t> count{0};
+        std::atomic<size_t> bytes{0};
+};
+
+inline AllocationCounters& Allocations(){
+        static AllocationCounters counters;
+        return counters;
+}
+
+struct PhaseStats{
+        std::string phase;
+        // section or file name, empty for whole phases
+        std::string detail;
+        double wall{0};
+        // user + system, summed over every thread of the process
+        double cpu{0};
+        // input bytes the phase reads
+        size_t bytes{0};
+        size_t allocations{0};
+        size_t allocated_bytes{0};
+};
+
+/*
+        Collects a record per instrumented phase. Phases running on a pool
+        record concurrently, their allocation counts include whatever else
+        the process did in the meantime.
+ */
+class Stats{
+public:
+        Stats(){
+                Allocations().enabled = true;
+        }
+        void Add(PhaseStats record){
+                std::lock_guard<std::mutex> lock(mtx_);
+                records_.push_back(std::move(record));
+        }
+        std::vector<PhaseStats> Records()const{
+                std::lock_guard<std::mutex> lock(mtx_);
+                return records_;
+        }
+        // per phase totals, then the slowest named parts
+        void WriteSummary(std::ostream& ostr, size_t slowest = 10)const{
+                auto records = Records();
+                std::map<std::string, std::pair<PhaseStats, size_t> > totals;
+                for(auto const& _ : records){
+                        auto& total = totals[_.phase];
+                        total.first.wall += _.wall;
+                        total.first.cpu += _.cpu;
+                        total.first.bytes += _.bytes;
+                        total.first.allocations += _.allocations;
+                        total.first.allocated_bytes += _.allocated_bytes;
+                        ++total.second;
+                }
+                char line[256];
+                std::snprintf(line, sizeof(line), "%-26s %8s %12s %12s %10s %10s %12s\n",
+                              "phase", "count", "wall ms", "cpu ms", "MB/s", "allocs", "alloc KB");
+                ostr << line;
+                for(auto const& _ : totals){
+                        auto const& t = _.second.first;
+                        std::snprintf(line, sizeof(line), "%-26s %8zu %12.3f %12.3f %10.1f %10zu %12.1f\n",
+                                      _.first.c_str(), _.second.second, t.wall * 1e3, t.cpu * 1e3,
+                                      t.wall > 0 ? t.bytes / t.wall / 1e6 : 0.0,
+                                      t.allocations, t.allocated_bytes / 1024.0);
+                        ostr << line;
+                }
+
+                std::vector<PhaseStats const*> named;
+                for(auto const& _ : records){
+                        if( ! _.detail.empty() )
+                                named.push_back(&_);
+                }
+                slowest = std::min(slowest, named.size());
+                std::partial_sort(named.begin(), named.begin() + slowest, named.end(),
+                                  [](PhaseStats const* l, PhaseStats const* r){ return l->wall > r->wall; });
+                if( slowest )
+                        ostr << "\nslowest\n";
+                for(size_t i=0;i!=slowest;++i){
+                        auto const& t = *named[i];
+                        std::snprintf(line, sizeof(line), "%-26s %-32s %12.3f %12zu %10zu\n",
+                                      t.phase.c_str(), t.detail.c_str(), t.wall * 1e3, t.bytes, t.allocations);
+                        ostr << line;
+                }
+        }
+private:
+        mutable std::mutex mtx_;
+        std::vector<PhaseStats> records_;
+};
+
+/*
+        Records the scope as one phase. With a null Stats nothing is
+        measured, and building with CELF_NO_STATS removes the scopes
+        altogether
+ */
+class StatsScope{
+public:
+#ifdef CELF_NO_STATS
+        StatsScope(Stats* stats, const char* phase, size_t bytes = 0){}
+        StatsScope(Stats* stats, const char* phase, boost::string_view detail, size_t bytes){}
+#else
+        StatsScope(Stats* stats, const char* phase, size_t bytes = 0)
+                : StatsScope(stats, phase, boost::string_view{}, bytes)
+        {}
+        StatsScope(Stats* stats, const char* phase, boost::string_view detail, size_t bytes)
+                : stats_(stats)
+        {
+                if( ! stats_ )
+                        return;
+                record_.phase = phase;
+                record_.detail = detail.to_string();
+                record_.bytes = bytes;
+                record_.allocations = Allocations().count.load(std::memory_order_relaxed);
+                record_.allocated_bytes = Allocations().bytes.load(std::memory_order_relaxed);
+                timer_.emplace();
+        }
+        ~StatsScope(){
+                if( ! stats_ )
+                        return;
+                auto elapsed = timer_->elapsed();
+                record_.wall = elapsed.wall / 1e9;
+                record_.cpu = ( elapsed.user + elapsed.system ) / 1e9;
+                record_.allocations = Allocations().count.load(std::memory_order_relaxed) - record_.allocations;
+                record_.allocated_bytes = Allocations().bytes.load(std::memory_order_relaxed) - record_.allocated_bytes;
+                stats_->Add(std::move(record_));
+        }
+private:
+        Stats* stats_;
+        PhaseStats record_;
+        boost::optional<boost::timer::cpu_timer> timer_;
+#endif
+        StatsScope(StatsScope const&) = delete;
+        StatsScope& operator=(StatsScope const&) = delete;
+};
+
+} // end namespace celf
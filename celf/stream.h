@@ -0,0 +1,432 @@
+#pragma once
+
+#include "celf/elf_file.h"
+#include "celf/stats.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <limits>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace celf{
+
+/*
+        Anonymous mapping that bytes are written into at their file
+        offset. Pages that are never written cost nothing and Discard
+        gives written ones back, so a streamed file only occupies memory
+        for the ranges that are kept. Growing may move the mapping
+ */
+class SparseImage{
+public:
+        SparseImage()=default;
+        ~SparseImage(){
+                if( addr_ )
+                        ::munmap(addr_, capacity_);
+        }
+        SparseImage(SparseImage const&)=delete;
+        SparseImage& operator=(SparseImage const&)=delete;
+
+        void Write(size_t offset, const char* data, size_t size){
+                Reserve(offset + size);
+                std::memcpy(addr_ + offset, data, size);
+                size_ = std::max(size_, offset + size);
+        }
+        // [first, last) reads as zeros again, only whole pages are freed
+        void Discard(size_t first, size_t last){
+                first = ( first + PageSize() - 1 ) / PageSize() * PageSize();
+                last = last / PageSize() * PageSize();
+                if( addr_ && first < last && last <= capacity_ )
+                        ::madvise(addr_ + first, last - first, MADV_DONTNEED);
+        }
+        void Resize(size_t size){
+                Reserve(size);
+                size_ = size;
+        }
+        MemoryView View()const{
+                return MemoryView{addr_, size_};
+        }
+private:
+        static size_t PageSize(){
+                static const size_t page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+                return page_size;
+        }
+        void Reserve(size_t size){
+                if( size <= capacity_ )
+                        return;
+                size_t capacity = std::max<size_t>(capacity_, 1 << 20);
+                while( capacity < size )
+                        capacity *= 2;
+                void* addr;
+                if( addr_ )
+                        addr = ::mremap(addr_, capacity_, capacity, MREMAP_MAYMOVE);
+                else
+                        addr = ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE,
+                                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+                if( addr == MAP_FAILED )
+                        throw std::bad_alloc{};
+                addr_ = static_cast<char*>(addr);
+                capacity_ = capacity;
+        }
+
+        char* addr_{nullptr};
+        size_t capacity_{0};
+        size_t size_{0};
+};
+
+/*
+        Incremental parser for input that can't be mapped or seeked, fed
+        in chunks of any size in file order.
+
+        Until the section header table has gone past everything is kept,
+        as there is no telling what the bytes are. After that only the
+        header tables, the sections ElfParser decodes, notes and the
+        headers of compressed sections are kept, and whatever was
+        buffered outside them is released. The usual layout puts the
+        section headers last, so the peak is about the file size, but a
+        file with the table near the start, or a filtered read, stays
+        small. With keep_all nothing is released, for callers that read
+        every byte such as HashContents.
+
+        on_header is called as soon as the ELF header has arrived and
+        on_section as soon as a kept section is complete. The view is
+        only valid during the call. Finish hands the kept bytes to
+        ElfParser, so the result is the same as parsing the whole file.
+ */
+class StreamParser{
+public:
+        // records the parse phases when set
+        Stats* stats{nullptr};
+        // only what it selects is decoded by Finish when set
+        Filter const* filter{nullptr};
+        // keeps the whole file rather than the sections ElfParser decodes
+        bool keep_all{false};
+
+        std::function<void(Elf64_Ehdr const&)> on_header;
+        std::function<void(size_t, Elf64_Shdr const&, MemoryView)> on_section;
+
+        StreamParser():image_{std::make_shared<SparseImage>()}{}
+
+        // false once the input can't be parsed, Finish says why
+        bool Feed(const char* data, size_t size){
+                if( ! error_.empty() )
+                        return false;
+                size_t first = offset_;
+                offset_ += size;
+                if( ! kept_ready_ ){
+                        image_->Write(first, data, size);
+                } else {
+                        Keep(first, data, size);
+                }
+                if( ! header_ready_ && offset_ >= sizeof(Elf64_Ehdr) )
+                        ReadHeader();
+                if( header_ready_ && ! kept_ready_ && error_.empty() )
+                        ReadSectionHeaders();
+                if( kept_ready_ )
+                        EmitSections();
+                return error_.empty();
+        }
+
+        ElfParser::ResultType Finish(){
+                if( not_elf_ )
+                        return NotElf{};
+                if( ! error_.empty() )
+                        return error_;
+                image_->Resize(offset_);
+                ElfParser parser;
+                parser.stats = stats;
+                parser.filter = filter;
+                auto view = image_->View();
+                return parser.Parse(image_, view);
+        }
+
+        size_t Offset()const{ return offset_; }
+private:
+        void ReadHeader(){
+                auto view = image_->View();
+                if( std::memcmp(view.data(), "\x7f" "ELF", 4) != 0 ){
+                        error_ = NotElf::Message();
+                        not_elf_ = true;
+                        return;
+                }
+                header_ = view.Read<Elf64_Ehdr>(0);
+                header_ready_ = true;
+                if( on_header )
+                        on_header(header_);
+        }
+
+        // once the whole section header table is in, decides what to keep
+        void ReadSectionHeaders(){
+                std::vector<std::pair<size_t, size_t> > kept;
+                auto add = [&](size_t offset, size_t size){
+                        if( size != 0 && offset + size > offset )
+                                kept.emplace_back(offset, offset + size);
+                };
+                add(0, keep_all ? std::numeric_limits<size_t>::max() : sizeof(Elf64_Ehdr));
+                size_t ph_size = static_cast<size_t>(header_.e_phnum) * header_.e_phentsize;
+                if( header_.e_phoff != 0 )
+                        add(header_.e_phoff, ph_size);
+                size_t sh_count = header_.e_shnum;
+                if( header_.e_shoff != 0 && sh_count == 0 ){
+                        // extended numbering, the count is in section header 0
+                        if( header_.e_shoff + sizeof(Elf64_Shdr) < header_.e_shoff ){
+                                kept_ready_ = true;
+                                return;
+                        }
+                        if( offset_ < header_.e_shoff + sizeof(Elf64_Shdr) )
+                                return;
+                        sh_count = SectionCount(header_, image_->View());
+                }
+                size_t sh_size = sh_count * header_.e_shentsize;
+                if( header_.e_shoff != 0 ){
+                        if( header_.e_shentsize < sizeof(Elf64_Shdr) ||
+                            ( sh_count != 0 && sh_size / sh_count != header_.e_shentsize ) ||
+                            header_.e_shoff + sh_size < header_.e_shoff ){
+                                // ElfParser reports it
+                                kept_ready_ = true;
+                                return;
+                        }
+                        if( offset_ < header_.e_shoff + sh_size )
+                                return;
+                }
+                auto view = image_->View();
+                if( header_.e_phoff != 0 && view.Contains(header_.e_phoff, ph_size) &&
+                    header_.e_phentsize >= sizeof(Elf64_Phdr) ){
+                        TableView<Elf64_Phdr> table{view.Slice(header_.e_phoff, ph_size),
+                                                    header_.e_phentsize, header_.e_phnum};
+                        for(auto const& ph : table){
+                                if( ph.p_type == PT_NOTE ) // for the build-id
+                                        add(ph.p_offset, ph.p_filesz);
+                        }
+                }
+                if( header_.e_shoff != 0 ){
+                        add(header_.e_shoff, sh_size);
+                        section_headers_ = TableView<Elf64_Shdr>{view.Slice(header_.e_shoff, sh_size),
+                                                                 header_.e_shentsize, sh_count};
+                        for(size_t i=0;i!=section_headers_.size();++i){
+                                auto sh = section_headers_[i];
+                                switch(sh.sh_type){
+                                case SHT_STRTAB:
+                                case SHT_SYMTAB:
+                                case SHT_DYNSYM:
+                                case SHT_SYMTAB_SHNDX:
+                                case SHT_RELA:
+                                case SHT_REL:
+                                case SHT_DYNAMIC:
+                                case SHT_NOTE:
+                                        add(sh.sh_offset, sh.sh_size);
+                                        if( sh.sh_offset + sh.sh_size > sh.sh_offset )
+                                                pending_.push_back(i);
+                                        break;
+                                }
+                                // the header ElfFile::CompressionHeader reads
+                                if( sh.sh_flags & SHF_COMPRESSED )
+                                        add(sh.sh_offset, std::min<size_t>(sh.sh_size, sizeof(Elf64_Chdr)));
+                        }
+                        // the table itself may move when the image grows
+                        section_table_ = std::string(view.data() + header_.e_shoff, sh_size);
+                        section_headers_ = TableView<Elf64_Shdr>{MemoryView{section_table_.data(), sh_size},
+                                                                 header_.e_shentsize, sh_count};
+                }
+                std::sort(kept.begin(), kept.end());
+                for(auto const& _ : kept){
+                        if( ! kept_.empty() && _.first <= kept_.back().second )
+                                kept_.back().second = std::max(kept_.back().second, _.second);
+                        else
+                                kept_.push_back(_);
+                }
+                // give back what was buffered outside them
+                size_t last = 0;
+                for(auto const& _ : kept_){
+                        if( _.first >= offset_ )
+                                break;
+                        image_->Discard(last, _.first);
+                        last = _.second;
+                }
+                if( last < offset_ )
+                        image_->Discard(last, offset_);
+                std::sort(pending_.begin(), pending_.end(), [this](size_t l, size_t r){
+                        return section_headers_[l].sh_offset + section_headers_[l].sh_size <
+                               section_headers_[r].sh_offset + section_headers_[r].sh_size;
+                });
+                kept_ready_ = true;
+        }
+
+        // writes the parts of [first, first + size) inside a kept range
+        void Keep(size_t first, const char* data, size_t size){
+                size_t last = first + size;
+                auto iter = std::upper_bound(kept_.begin(), kept_.end(), first,
+                                             [](size_t o, std::pair<size_t, size_t> const& r){
+                        return o < r.second;
+                });
+                for(; iter != kept_.end() && iter->first < last; ++iter){
+                        size_t from = std::max(first, iter->first);
+                        size_t to = std::min(last, iter->second);
+                        image_->Write(from, data + ( from - first ), to - from);
+                }
+        }
+
+        // pending_ is ordered by end offset
+        void EmitSections(){
+                auto view = image_->View();
+                for(; next_pending_ != pending_.size(); ++next_pending_){
+                        auto idx = pending_[next_pending_];
+                        auto sh = section_headers_[idx];
+                        if( sh.sh_offset + sh.sh_size > offset_ )
+                                break;
+                        if( on_section && view.Contains(sh.sh_offset, sh.sh_size) )
+                                on_section(idx, sh, view.Slice(sh.sh_offset, sh.sh_size));
+                }
+        }
+
+        std::shared_ptr<SparseImage> image_;
+        size_t offset_{0};
+        std::string error_;
+        bool not_elf_{false};
+
+        bool header_ready_{false};
+        Elf64_Ehdr header_;
+
+        // set once it's known what to keep
+        bool kept_ready_{false};
+        // sorted and disjoint [first, last)
+        std::vector<std::pair<size_t, size_t> > kept_;
+        std::string section_table_;
+        TableView<Elf64_Shdr> section_headers_;
+        std::vector<size_t> pending_;
+        size_t next_pending_{0};
+};
+
+/*
+        Reads fd to the end in chunk_size reads and parses it as it goes.
+        An ar archive is split into its members and each member is parsed
+        on its own, the symbol and long name tables are skipped. f is
+        called with the member name, empty for a plain ELF file, and the
+        parse result. keep_all is passed on to StreamParser
+ */
+template<class F>
+bool ParseStream(int fd, F const& f, Filter const* filter = nullptr, Stats* stats = nullptr,
+                 bool keep_all = false, size_t chunk_size = 64 * 1024){
+        std::vector<char> buf(std::max<size_t>(chunk_size, 64));
+        size_t pos = 0;
+        size_t end = 0;
+        bool eof = false;
+        auto fill = [&](){
+                if( pos != end || eof )
+                        return;
+                pos = end = 0;
+                for(;;){
+                        auto ret = ::read(fd, buf.data(), buf.size());
+                        if( ret < 0 && errno == EINTR )
+                                continue;
+                        if( ret < 0 )
+                                throw std::runtime_error(std::string{"read failed: "} + std::strerror(errno));
+                        eof = ret == 0;
+                        end = static_cast<size_t>(ret);
+                        return;
+                }
+        };
+        // up to n bytes, fewer only at the end of the input
+        auto read = [&](size_t n, auto const& sink){
+                size_t done = 0;
+                while( done != n ){
+                        fill();
+                        if( pos == end )
+                                break;
+                        size_t len = std::min(n - done, end - pos);
+                        sink(buf.data() + pos, len);
+                        pos += len;
+                        done += len;
+                }
+                return done;
+        };
+        auto read_string = [&](size_t n){
+                std::string result;
+                read(n, [&](const char* data, size_t len){ result.append(data, len); });
+                return result;
+        };
+        auto parse = [&](std::string const& name, std::string const& head, size_t size){
+                StreamParser parser;
+                parser.filter = filter;
+                parser.stats = stats;
+                parser.keep_all = keep_all;
+                parser.Feed(head.data(), head.size());
+                read(size, [&](const char* data, size_t len){ parser.Feed(data, len); });
+                f(name, parser.Finish());
+        };
+
+        auto magic = read_string(8);
+        if( magic != "!<arch>\n" ){
+                parse(std::string{}, magic, static_cast<size_t>(-1));
+                return true;
+        }
+        std::string long_names;
+        for(;;){
+                auto header = read_string(60);
+                if( header.empty() )
+                        return true;
+                if( header.size() != 60 || header.compare(58, 2, "`\n") != 0 )
+                        return false;
+                auto size = static_cast<size_t>(std::strtoull(header.substr(48, 10).c_str(), nullptr, 10));
+                auto name = header.substr(0, 16);
+                name.erase(name.find_last_not_of(' ') + 1);
+                std::string head;
+                if( name == "/" || name == "/SYM64/" ){
+                        read(size, [](const char*, size_t){});
+                } else if( name == "//" ){
+                        long_names = read_string(size);
+                } else {
+                        if( name.size() > 1 && name[0] == '/' ){
+                                // GNU, offset into the long name table
+                                auto offset = static_cast<size_t>(std::strtoull(name.c_str() + 1, nullptr, 10));
+                                auto last = long_names.find("/\n", offset);
+                                name = offset < long_names.size() ? long_names.substr(offset, last - offset) : name;
+                        } else if( name.compare(0, 3, "#1/") == 0 ){
+                                // BSD, the name leads the data
+                                auto len = std::min<size_t>(std::strtoull(name.c_str() + 3, nullptr, 10), size);
+                                name = read_string(len);
+                                name.erase(name.find_last_not_of('\0') + 1);
+                                size -= len;
+                        } else if( ! name.empty() && name.back() == '/' ){
+                                name.pop_back();
+                        }
+                        if( name.compare(0, 9, "__.SYMDEF") == 0 ){
+                                // BSD symbol table, "__.SYMDEF SORTED" and "__.SYMDEF_64" too
+                                read(size, [](const char*, size_t){});
+                        } else {
+                                head = read_string(std::min<size_t>(size, 8));
+                                parse(name, head, size - head.size());
+                        }
+                }
+                // members are 2 byte aligned
+                if( size % 2 == 1 )
+                        read(1, [](const char*, size_t){});
+        }
+}
+
+// whether filename has to go through ParseStream rather than be mapped
+inline bool NeedsStreaming(std::string const& filename){
+        if( filename == "-" )
+                return true;
+        struct stat st;
+        if( ::stat(filename.c_str(), &st) != 0 )
+                return false;
+        if( ! S_ISREG(st.st_mode) )
+                return true;
+        char magic[8];
+        int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if( fd == -1 )
+                return false;
+        bool archive = ::read(fd, magic, sizeof(magic)) == sizeof(magic) &&
+                       std::memcmp(magic, "!<arch>\n", sizeof(magic)) == 0;
+        ::close(fd);
+        return archive;
+}
+
+} // end namespace celf
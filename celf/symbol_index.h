@@ -0,0 +1,450 @@
+#pragma once
+
+#include "celf/elf_file.h"
+#include "celf/thread_pool.h"
+
+#include <vector>
+#include <algorithm>
+#include <boost/optional.hpp>
+
+namespace celf{
+
+// hash function used by DT_GNU_HASH
+inline std::uint32_t GnuHash(boost::string_view name){
+        std::uint32_t h = 5381;
+        for(unsigned char c : name)
+                h = h * 33 + c;
+        return h;
+}
+
+// hash function used by DT_HASH
+inline std::uint32_t SysvHash(boost::string_view name){
+        std::uint32_t h = 0;
+        for(unsigned char c : name){
+                h = ( h << 4 ) + c;
+                std::uint32_t g = h & 0xF0000000;
+                if( g )
+                        h ^= g >> 24;
+                h &= ~g;
+        }
+        return h;
+}
+
+/*
+        View of a SHT_HASH section
+
+                nbucket | nchain | bucket[nbucket] | chain[nchain]
+ */
+struct SysvHashTable{
+        explicit SysvHashTable(MemoryView mem):mem_{mem}{
+                nbucket_ = mem_.Read<Elf64_Word>(0);
+                nchain_  = mem_.Read<Elf64_Word>(4);
+                if( ! mem_.Contains(8, ( static_cast<size_t>(nbucket_) + nchain_ ) * 4) )
+                        throw std::domain_error("hash table out of range");
+        }
+        template<class Match>
+        boost::optional<Elf64_Word> Find(boost::string_view name, Match const& match)const{
+                if( nbucket_ == 0 )
+                        return boost::none;
+                auto h = SysvHash(name);
+                auto idx = Bucket(h % nbucket_);
+                // a corrupt chain can't loop forever
+                for(size_t guard=0; idx != 0 && idx < nchain_ && guard != nchain_; ++guard){
+                        if( match(idx) )
+                                return idx;
+                        idx = Chain(idx);
+                }
+                return boost::none;
+        }
+private:
+        Elf64_Word Bucket(size_t idx)const{ return mem_.Read<Elf64_Word>(8 + idx * 4); }
+        Elf64_Word Chain(size_t idx)const{ return mem_.Read<Elf64_Word>(8 + ( nbucket_ + idx ) * 4); }
+
+        MemoryView mem_;
+        Elf64_Word nbucket_;
+        Elf64_Word nchain_;
+};
+
+/*
+        View of a SHT_GNU_HASH section
+
+                nbuckets | symoffset | bloom_size | bloom_shift |
+                bloom[bloom_size] (64 bit) | buckets[nbuckets] | chain[]
+
+        chain[] has an entry for every symbol from symoffset onwards, the
+        low bit marks the end of a bucket
+ */
+struct GnuHashTable{
+        explicit GnuHashTable(MemoryView mem):mem_{mem}{
+                nbuckets_    = mem_.Read<Elf64_Word>(0);
+                symoffset_   = mem_.Read<Elf64_Word>(4);
+                bloom_size_  = mem_.Read<Elf64_Word>(8);
+                bloom_shift_ = mem_.Read<Elf64_Word>(12);
+                buckets_ = 16 + static_cast<size_t>(bloom_size_) * 8;
+                chain_ = buckets_ + static_cast<size_t>(nbuckets_) * 4;
+                if( ! mem_.Contains(0, chain_) )
+                        throw std::domain_error("hash table out of range");
+        }
+        template<class Match>
+        boost::optional<Elf64_Word> Find(boost::string_view name, Match const& match)const{
+                if( nbuckets_ == 0 || bloom_size_ == 0 )
+                        return boost::none;
+                auto h = GnuHash(name);
+                auto word = mem_.Read<Elf64_Xword>(16 + ( ( h / 64 ) % bloom_size_ ) * 8);
+                Elf64_Xword mask = ( Elf64_Xword{1} << ( h % 64 ) ) |
+                                   ( Elf64_Xword{1} << ( ( h >> bloom_shift_ ) % 64 ) );
+                if( ( word & mask ) != mask )
+                        return boost::none;
+                Elf64_Word idx = mem_.Read<Elf64_Word>(buckets_ + ( h % nbuckets_ ) * 4);
+                if( idx < symoffset_ )
+                        return boost::none;
+                for(;;++idx){
+                        size_t offset = chain_ + static_cast<size_t>(idx - symoffset_) * 4;
+                        if( ! mem_.Contains(offset, 4) )
+                                return boost::none;
+                        auto h2 = mem_.Read<Elf64_Word>(offset);
+                        if( ( h | 1 ) == ( h2 | 1 ) && match(idx) )
+                                return idx;
+                        if( h2 & 1 )
+                                return boost::none;
+                }
+        }
+private:
+        MemoryView mem_;
+        Elf64_Word nbuckets_;
+        Elf64_Word symoffset_;
+        Elf64_Word bloom_size_;
+        Elf64_Word bloom_shift_;
+        size_t buckets_;
+        size_t chain_;
+};
+
+struct SymbolRef{
+        Elf64_Word section; // index of the symbol table section
+        Elf64_Word index;   // index within the symbol table
+};
+
+/*
+        Lookup structure over every symbol table of an ElfFile
+
+        Names go into an open addressing hash table, unless the table
+        already has a SHT_GNU_HASH or SHT_HASH section, in which case that
+        is used directly. GNU hash chains leave out undefined symbols, so
+        those of a GNU hashed table still go into the open addressing one.
+
+        Addresses go into arrays sorted by st_value. Every symbol also
+        links to the nearest one before it that ends later, so a lookup
+        skips everything that ends too early in one step. A lookup costs
+        a binary search plus one step per symbol that contains the start
+        of the one found, which is the nesting depth there, however large
+        the symbols before it are.
+ */
+struct SymbolIndex{
+        // with a pool, names are hashed in parallel chunks of each table
+        explicit SymbolIndex(ElfFile const& elf, ThreadPool* pool = nullptr):elf_{&elf}{
+                FindTables();
+
+                std::vector<NameEntry> names;
+                std::vector<std::uint32_t> hashes;
+                for(auto idx : symtabs_)
+                        AddNames(idx, pool, names, hashes);
+                for(auto idx : dynsyms_){
+                        if( ! HasElfHash(idx) )
+                                AddNames(idx, pool, names, hashes);
+                        else if( HasGnuHash(idx) )
+                                AddNames(idx, pool, names, hashes, true);
+                }
+                BuildHash(names, hashes);
+                names_.Assign(std::move(names));
+
+                // .dynsym is a subset of .symtab, so only fall back to it
+                // for stripped files
+                std::vector<std::pair<Elf64_Xword, Range> > pending;
+                for(auto idx : ( symtabs_.empty() ? dynsyms_ : symtabs_ ))
+                        AddAddresses(idx, pending);
+                BuildAddresses(pending);
+        }
+        SymbolIndex(SymbolIndex const&)=delete;
+        SymbolIndex& operator=(SymbolIndex const&)=delete;
+
+        SymbolEntry Get(SymbolRef ref)const{
+                return Table(ref.section).at(ref.index);
+        }
+        boost::string_view Name(SymbolRef ref)const{
+                auto sym = Get(ref);
+                if( sym.st_name == 0 )
+                        return boost::string_view{};
+                return elf_->LookupName(Table(ref.section).Link(), sym.st_name);
+        }
+
+        // prefers a defined symbol, falling back to the first undefined one
+        boost::optional<SymbolRef> FindByName(boost::string_view name)const{
+                boost::optional<SymbolRef> undefined;
+                auto consider = [&](SymbolRef ref){
+                        if( Get(ref).IsDefined() )
+                                return true;
+                        if( ! undefined )
+                                undefined = ref;
+                        return false;
+                };
+                auto h = GnuHash(name);
+                if( ! slots_.empty() ){
+                        for(size_t pos = h & mask_;; pos = ( pos + 1 ) & mask_){
+                                auto const& slot = slots_[pos];
+                                if( slot.entry == 0 )
+                                        break;
+                                if( slot.hash != h || slot.entry > names_.size() )
+                                        continue;
+                                auto const& e = names_[slot.entry - 1];
+                                if( NameOf(e) == name && consider(SymbolRef{e.section, e.index}) )
+                                        return SymbolRef{e.section, e.index};
+                        }
+                }
+                for(auto const& _ : gnu_hashes_){
+                        if( auto ret = FindInElfHash(_.first, _.second, name) )
+                                if( consider(SymbolRef{_.first, *ret}) )
+                                        return SymbolRef{_.first, *ret};
+                }
+                // prefer the GNU table when a file has both
+                for(auto const& _ : sysv_hashes_){
+                        if( HasGnuHash(_.first) )
+                                continue;
+                        if( auto ret = FindInElfHash(_.first, _.second, name) )
+                                if( consider(SymbolRef{_.first, *ret}) )
+                                        return SymbolRef{_.first, *ret};
+                }
+                return undefined;
+        }
+
+        // innermost symbol whose [st_value, st_value + st_size) contains
+        // addr, zero sized symbols only match their own address
+        boost::optional<SymbolRef> FindByAddress(Elf64_Xword addr)const{
+                auto iter = std::upper_bound(starts_.begin(), starts_.end(), addr);
+                // one past the index, 0 when there is nothing left, and
+                // always moving back even over a damaged cache entry
+                for(size_t pos = iter - starts_.begin(); pos != 0; pos = std::min<size_t>(outer_[pos - 1], pos - 1)){
+                        if( ranges_[pos - 1].end > addr )
+                                return ranges_[pos - 1].ref;
+                }
+                return boost::none;
+        }
+
+        size_t NameCount()const{ return names_.size(); }
+        size_t AddressCount()const{ return starts_.size(); }
+        // what the index keeps on the heap, not counting a cache file
+        // it borrows from
+        size_t HeapBytes()const{
+                return names_.HeapBytes() + slots_.HeapBytes() + starts_.HeapBytes() +
+                       outer_.HeapBytes() + ranges_.HeapBytes() +
+                       ( symtabs_.capacity() + dynsyms_.capacity() ) * sizeof(Elf64_Word) +
+                       gnu_hashes_.capacity() * sizeof(gnu_hashes_[0]) +
+                       sysv_hashes_.capacity() * sizeof(sysv_hashes_[0]);
+        }
+private:
+        friend class IndexCache;
+
+        // everything but the arrays, which the caller fills in
+        struct Empty{};
+        SymbolIndex(ElfFile const& elf, Empty):elf_{&elf}{
+                FindTables();
+        }
+
+        void FindTables(){
+                auto const& elf = *elf_;
+                for(Elf64_Word idx=0;idx!=elf.sections.size();++idx){
+                        if( auto ptr = boost::get<SymbolTable>(&elf.sections[idx]) ){
+                                if( ptr->IsDynamic() )
+                                        dynsyms_.push_back(idx);
+                                else
+                                        symtabs_.push_back(idx);
+                        }
+                }
+                for(Elf64_Word idx=0;idx!=elf.section_headers.size();++idx){
+                        auto sh = elf.section_headers[idx];
+                        if( sh.sh_type != SHT_GNU_HASH && sh.sh_type != SHT_HASH )
+                                continue;
+                        if( ! elf.memory.Contains(sh.sh_offset, sh.sh_size) )
+                                continue;
+                        if( std::find(dynsyms_.begin(), dynsyms_.end(), sh.sh_link) == dynsyms_.end() )
+                                continue;
+                        auto mem = elf.memory.Slice(sh.sh_offset, sh.sh_size);
+                        try{
+                                if( sh.sh_type == SHT_GNU_HASH ){
+                                        gnu_hashes_.emplace_back(sh.sh_link, GnuHashTable{mem});
+                                } else {
+                                        sysv_hashes_.emplace_back(sh.sh_link, SysvHashTable{mem});
+                                }
+                        } catch(std::domain_error const&){
+                        }
+                }
+        }
+
+        struct NameEntry{
+                Elf64_Off name_offset; // file offset of the name
+                Elf64_Word name_size;
+                Elf64_Word section;
+                Elf64_Word index;
+        };
+        struct Slot{
+                std::uint32_t hash;
+                std::uint32_t entry; // one past the index into names_, 0 is empty
+        };
+        struct Range{
+                Elf64_Xword end;
+                SymbolRef ref;
+        };
+
+        SymbolTable const& Table(Elf64_Word section)const{
+                return boost::get<SymbolTable>(elf_->sections.at(section));
+        }
+        boost::string_view NameOf(NameEntry const& e)const{
+                auto mem = elf_->memory.Slice(e.name_offset, e.name_size);
+                return boost::string_view{mem.data(), mem.size()};
+        }
+        bool HasGnuHash(Elf64_Word section)const{
+                for(auto const& _ : gnu_hashes_)
+                        if( _.first == section )
+                                return true;
+                return false;
+        }
+        bool HasElfHash(Elf64_Word section)const{
+                if( HasGnuHash(section) )
+                        return true;
+                for(auto const& _ : sysv_hashes_)
+                        if( _.first == section )
+                                return true;
+                return false;
+        }
+        template<class Hash>
+        boost::optional<Elf64_Word> FindInElfHash(Elf64_Word section, Hash const& hash, boost::string_view name)const{
+                auto const& table = Table(section);
+                return hash.Find(name, [&](Elf64_Word idx){
+                        if( idx >= table.size() )
+                                return false;
+                        auto sym = table[idx];
+                        return sym.st_name != 0 && elf_->LookupName(table.Link(), sym.st_name) == name;
+                });
+        }
+
+        // only the undefined symbols of the table when undefined_only
+        void AddNames(Elf64_Word section, ThreadPool* pool,
+                      std::vector<NameEntry>& names, std::vector<std::uint32_t>& hashes,
+                      bool undefined_only = false){
+                auto const& table = Table(section);
+                auto strtab = boost::get<StringTable>(&elf_->sections.at(table.Link()));
+                if( ! strtab )
+                        return;
+                auto base = static_cast<Elf64_Off>(strtab->Memory().data() - elf_->memory.data());
+                constexpr size_t chunk_size = 64 * 1024;
+                struct Part{
+                        std::vector<NameEntry> names;
+                        std::vector<std::uint32_t> hashes;
+                };
+                std::vector<Part> parts(table.size() / chunk_size + 1);
+                ParallelChunks(pool, table.size(), chunk_size, [&](size_t first, size_t last){
+                        auto& part = parts[first / chunk_size];
+                        // entry 0 is always the null symbol
+                        for(size_t idx=std::max<size_t>(first, 1);idx<last;++idx){
+                                auto sym = table[idx];
+                                if( sym.st_name == 0 || sym.st_name >= strtab->Memory().size() )
+                                        continue;
+                                if( undefined_only && sym.IsDefined() )
+                                        continue;
+                                auto name = strtab->At(sym.st_name);
+                                part.names.push_back(NameEntry{
+                                        base + sym.st_name,
+                                        static_cast<Elf64_Word>(name.size()),
+                                        section,
+                                        static_cast<Elf64_Word>(idx)});
+                                part.hashes.push_back(GnuHash(name));
+                        }
+                });
+                for(auto& _ : parts){
+                        names.insert(names.end(), _.names.begin(), _.names.end());
+                        hashes.insert(hashes.end(), _.hashes.begin(), _.hashes.end());
+                }
+        }
+        void BuildHash(std::vector<NameEntry> const& names, std::vector<std::uint32_t> const& hashes){
+                if( names.empty() )
+                        return;
+                size_t capacity = 16;
+                while( capacity < names.size() * 2 )
+                        capacity *= 2;
+                std::vector<Slot> slots(capacity, Slot{0, 0});
+                mask_ = capacity - 1;
+                for(size_t idx=0;idx!=names.size();++idx){
+                        auto h = hashes[idx];
+                        size_t pos = h & mask_;
+                        for(; slots[pos].entry != 0; pos = ( pos + 1 ) & mask_);
+                        slots[pos] = Slot{h, static_cast<std::uint32_t>(idx + 1)};
+                }
+                slots_.Assign(std::move(slots));
+        }
+
+        void AddAddresses(Elf64_Word section, std::vector<std::pair<Elf64_Xword, Range> >& pending){
+                auto const& table = Table(section);
+                for(size_t idx=1;idx<table.size();++idx){
+                        auto sym = table[idx];
+                        if( ! sym.IsDefined() || sym.st_shndx == SHN_ABS )
+                                continue;
+                        if( sym.Type() == STT_SECTION || sym.Type() == STT_FILE )
+                                continue;
+                        auto start = ToXword(sym.st_value);
+                        auto end = start + std::max<Elf64_Xword>(sym.st_size, 1);
+                        pending.emplace_back(start, Range{end, SymbolRef{section, static_cast<Elf64_Word>(idx)}});
+                }
+        }
+        void BuildAddresses(std::vector<std::pair<Elf64_Xword, Range> >& pending){
+                std::stable_sort(pending.begin(), pending.end(), [](auto const& l, auto const& r){
+                        return l.first < r.first;
+                });
+                std::vector<Elf64_Xword> starts;
+                std::vector<Elf64_Word> outer;
+                std::vector<Range> ranges;
+                starts.reserve(pending.size());
+                ranges.reserve(pending.size());
+                outer.reserve(pending.size());
+                // indices of symbols with ever smaller ends, the nearest
+                // that ends later than the next one is on top
+                std::vector<Elf64_Word> stack;
+                for(auto const& _ : pending){
+                        while( ! stack.empty() && ranges[stack.back()].end <= _.second.end )
+                                stack.pop_back();
+                        outer.push_back(stack.empty() ? 0 : stack.back() + 1);
+                        stack.push_back(static_cast<Elf64_Word>(ranges.size()));
+                        starts.push_back(_.first);
+                        ranges.push_back(_.second);
+                }
+                starts_.Assign(std::move(starts));
+                outer_.Assign(std::move(outer));
+                ranges_.Assign(std::move(ranges));
+        }
+
+        ElfFile const* elf_;
+        std::vector<Elf64_Word> symtabs_;
+        std::vector<Elf64_Word> dynsyms_;
+
+        // borrowed from a cache file, see celf/index_cache.h
+        std::shared_ptr<const void> storage_;
+
+        ArrayStore<NameEntry> names_;
+        ArrayStore<Slot> slots_;
+        size_t mask_{0};
+        std::vector<std::pair<Elf64_Word, GnuHashTable> > gnu_hashes_;
+        std::vector<std::pair<Elf64_Word, SysvHashTable> > sysv_hashes_;
+
+        ArrayStore<Elf64_Xword> starts_;
+        // one past the index of the nearest earlier symbol ending after
+        // this one, 0 for none
+        ArrayStore<Elf64_Word> outer_;
+        ArrayStore<Range> ranges_;
+};
+
+inline SymbolIndex const& ElfFile::Symbols(ThreadPool* pool)const{
+        std::call_once(symbols_once_, [this, pool](){
+                symbols_ = std::make_shared<SymbolIndex>(*this, pool);
+        });
+        return *symbols_;
+}
+
+} // end namespace celf
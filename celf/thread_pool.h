@@ -0,0 +1,206 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+namespace celf{
+
+/*
+        Fixed size pool where every worker owns a deque of tasks. A worker
+        takes its own tasks from the back, and when it runs out steals
+        from the front of the other workers' deques. Tasks posted from
+        inside a worker go to that worker's deque.
+
+        Tasks must not throw.
+ */
+struct ThreadPool{
+        explicit ThreadPool(size_t threads){
+                if( threads == 0 )
+                        threads = 1;
+                for(size_t i=0;i!=threads;++i)
+                        queues_.push_back(std::make_unique<Queue>());
+                for(size_t i=0;i!=threads;++i)
+                        threads_.emplace_back([this,i](){ Worker(i); });
+        }
+        ~ThreadPool(){
+                {
+                        std::lock_guard<std::mutex> lock(mtx_);
+                        stop_ = true;
+                }
+                cv_.notify_all();
+                for(auto& _ : threads_)
+                        _.join();
+        }
+        ThreadPool(ThreadPool const&)=delete;
+        ThreadPool& operator=(ThreadPool const&)=delete;
+
+        size_t size()const{ return threads_.size(); }
+
+        void Post(std::function<void()> task){
+                size_t idx = ( Current().pool == this ? Current().index : next_++ ) % queues_.size();
+                // counted before it can be taken, so a steal can't take
+                // queued_ below zero
+                {
+                        std::lock_guard<std::mutex> lock(mtx_);
+                        ++queued_;
+                }
+                {
+                        std::lock_guard<std::mutex> lock(queues_[idx]->mtx);
+                        queues_[idx]->tasks.push_back(std::move(task));
+                }
+                cv_.notify_one();
+        }
+        // runs one queued task on the calling thread, so a thread waiting
+        // on tasks can help instead of blocking
+        bool RunOne(){
+                size_t self = Current().pool == this ? Current().index : 0;
+                std::function<void()> task;
+                if( ! Take(self, task) )
+                        return false;
+                task();
+                return true;
+        }
+private:
+        struct Queue{
+                std::mutex mtx;
+                std::deque<std::function<void()> > tasks;
+        };
+        struct WorkerId{
+                ThreadPool* pool{nullptr};
+                size_t index{0};
+        };
+        static WorkerId& Current(){
+                static thread_local WorkerId id;
+                return id;
+        }
+
+        bool Take(size_t self, std::function<void()>& task){
+                {
+                        auto& q = *queues_[self];
+                        std::lock_guard<std::mutex> lock(q.mtx);
+                        if( ! q.tasks.empty() ){
+                                task = std::move(q.tasks.back());
+                                q.tasks.pop_back();
+                                --queued_;
+                                return true;
+                        }
+                }
+                for(size_t i=1;i!=queues_.size();++i){
+                        auto& q = *queues_[( self + i ) % queues_.size()];
+                        std::lock_guard<std::mutex> lock(q.mtx);
+                        if( ! q.tasks.empty() ){
+                                task = std::move(q.tasks.front());
+                                q.tasks.pop_front();
+                                --queued_;
+                                return true;
+                        }
+                }
+                return false;
+        }
+        void Worker(size_t self){
+                Current().pool = this;
+                Current().index = self;
+                for(;;){
+                        std::function<void()> task;
+                        if( Take(self, task) ){
+                                task();
+                                continue;
+                        }
+                        std::unique_lock<std::mutex> lock(mtx_);
+                        cv_.wait(lock, [this](){ return stop_ || queued_ != 0; });
+                        if( stop_ && queued_ == 0 )
+                                return;
+                }
+        }
+
+        std::vector<std::unique_ptr<Queue> > queues_;
+        std::vector<std::thread> threads_;
+        std::mutex mtx_;
+        std::condition_variable cv_;
+        std::atomic<size_t> queued_{0};
+        std::atomic<size_t> next_{0};
+        bool stop_{false};
+};
+
+/*
+        Runs a set of tasks on a pool and waits for all of them. The
+        waiting thread runs queued tasks itself, so groups can be used
+        from inside pool tasks. Without a pool tasks run inline.
+ */
+struct TaskGroup{
+        explicit TaskGroup(ThreadPool* pool):pool_{pool}{}
+        ~TaskGroup(){
+                Wait();
+        }
+        TaskGroup(TaskGroup const&)=delete;
+        TaskGroup& operator=(TaskGroup const&)=delete;
+
+        void Run(std::function<void()> task){
+                if( ! pool_ ){
+                        task();
+                        return;
+                }
+                {
+                        std::lock_guard<std::mutex> lock(mtx_);
+                        ++pending_;
+                }
+                pool_->Post([this, task = std::move(task)](){
+                        task();
+                        std::lock_guard<std::mutex> lock(mtx_);
+                        if( --pending_ == 0 )
+                                cv_.notify_all();
+                });
+        }
+        void Wait(){
+                if( ! pool_ )
+                        return;
+                for(;;){
+                        {
+                                std::lock_guard<std::mutex> lock(mtx_);
+                                if( pending_ == 0 )
+                                        return;
+                        }
+                        if( pool_->RunOne() )
+                                continue;
+                        // nothing left to help with, the rest is running
+                        std::unique_lock<std::mutex> lock(mtx_);
+                        cv_.wait(lock, [this](){ return pending_ == 0; });
+                        return;
+                }
+        }
+private:
+        ThreadPool* pool_;
+        std::mutex mtx_;
+        std::condition_variable cv_;
+        size_t pending_{0};
+};
+
+/*
+        Calls f(first, last) for consecutive chunks of [0, n), in parallel
+        when there is a pool
+ */
+template<class F>
+void ParallelChunks(ThreadPool* pool, size_t n, size_t chunk_size, F const& f){
+        if( chunk_size == 0 )
+                chunk_size = 1;
+        if( ! pool || n <= chunk_size ){
+                if( n != 0 )
+                        f(size_t{0}, n);
+                return;
+        }
+        TaskGroup group{pool};
+        for(size_t first=0;first < n;first += chunk_size){
+                size_t last = std::min(n, first + chunk_size);
+                group.Run([&f, first, last](){ f(first, last); });
+        }
+        group.Wait();
+}
+
+} // end namespace celf